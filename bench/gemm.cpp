@@ -0,0 +1,52 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <ndarray.h>
+
+// GFLOP/s of NDArray::matMult on N x N float and double products.
+//
+//   gemm_bench [N ...]      (default: 256 512 1024)
+//
+// Each size is run for at least a second after a warm-up product and the
+// rate is 2 N^3 flops per product over the mean time.
+
+template <typename T>
+void bench(int n) {
+    NDArray<T> a({n, n});
+    NDArray<T> b({n, n});
+    a.random();
+    b.random();
+
+    NDArray<T> c = a.matMult(b);
+    int reps = 0;
+    double seconds = 0;
+    auto start = std::chrono::steady_clock::now();
+    while (seconds < 1.0) {
+        c = a.matMult(b);
+        reps++;
+        seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    double flops = 2.0 * n * n * n * reps;
+    std::printf("N=%-5d %s %8.2f GFLOP/s  %9.3f ms\n", n, sizeof(T) == 4 ? "f32" : "f64",
+                flops / seconds / 1e9, seconds / reps * 1e3);
+}
+
+int main(int argc, char** argv) {
+    std::vector<int> sizes;
+    for (int i = 1; i < argc; i++) {
+        sizes.push_back(std::atoi(argv[i]));
+    }
+    if (sizes.empty()) {
+        sizes = {256, 512, 1024};
+    }
+    for (int n : sizes) {
+        if (n <= 0) {
+            std::fprintf(stderr, "gemm_bench: bad size\n");
+            return 1;
+        }
+        bench<float>(n);
+        bench<double>(n);
+    }
+    return 0;
+}
@@ -0,0 +1,102 @@
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <vector>
+#include <LR.h>
+
+// Time to convergence of LogisticRegression's solvers, gradient descent
+// against Newton (IRLS) and L-BFGS, each started from w = 0:
+//
+//   100000 x 8 and 20000 x 200, double: labels drawn from a known logistic
+//       model; maxerr is the largest gap to its weights
+//   1600 x 1, float: the data of main.cpp
+//
+// Gradient descent runs a fixed number of epochs, Newton and L-BFGS run
+// until the gradient norm reaches the default tolerance.
+
+template <typename T>
+void fitAndReport(const char* name, ndarray<T>& x, ndarray<T>& y, const std::vector<double>& truth,
+                  Solver solver, int epochs, T lr) {
+    long d = x.shape()[1];
+    LogisticRegression<T> model(x, y);
+    model.setSolver(solver);
+    model.setWeights(ndarray<T>({d, 1}));
+    model.setBias(ndarray<T>({1, 1}));
+
+    // fit() prints its progress; keep it out of the table
+    std::cout.setstate(std::ios::failbit);
+    auto start = std::chrono::steady_clock::now();
+    model.fit(epochs, lr);
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout.clear();
+
+    ndarray<T> w = model.getWeights();
+    double err = 0;
+    for (long j = 0; j < (long)truth.size(); j++) {
+        err = std::max(err, std::abs((double)w.at(j, 0) - truth[j]));
+    }
+    std::printf("%6ld x %-4ld %-15s %9.1f ms  w0 %9.5f  b %9.5f  acc %.4f", x.shape()[0], d, name, ms,
+                (double)w.at(0, 0), (double)model.getBias().at(0, 0), model.accuracy());
+    if (!truth.empty()) {
+        std::printf("  maxerr %.3g", err);
+    }
+    std::printf("\n");
+}
+
+// n x d standard normal features, labels drawn from a logistic model with
+// bias 0.3 and standard normal weights (returned)
+std::vector<double> synthetic(long n, long d, ndarray<double>& x, ndarray<double>& y) {
+    std::mt19937 rng(7);
+    std::normal_distribution<double> normal;
+    std::uniform_real_distribution<double> uniform;
+    std::vector<double> truth(d);
+    for (long j = 0; j < d; j++) {
+        truth[j] = normal(rng);
+    }
+    x = ndarray<double>({n, d});
+    y = ndarray<double>({n, 1});
+    for (long i = 0; i < n; i++) {
+        double z = 0.3;
+        for (long j = 0; j < d; j++) {
+            double v = normal(rng);
+            x.set(i, j, v);
+            z += v * truth[j];
+        }
+        y.set(i, 0, uniform(rng) < 1 / (1 + std::exp(-z)) ? 1.0 : 0.0);
+    }
+    return truth;
+}
+
+void compare(long n, long d, int gdEpochs) {
+    ndarray<double> x;
+    ndarray<double> y;
+    std::vector<double> truth = synthetic(n, d, x, y);
+    char name[32];
+    std::snprintf(name, sizeof(name), "GD %d epochs", gdEpochs);
+    fitAndReport(name, x, y, truth, Solver::GradientDescent, gdEpochs, 1.0);
+    fitAndReport("Newton", x, y, truth, Solver::Newton, 100, 0.0);
+    fitAndReport("L-BFGS", x, y, truth, Solver::LBFGS, 500, 0.0);
+}
+
+// main.cpp's training set: x = i for i < 1600, labelled 1 on even i
+void compareMain() {
+    ndarray<float> x({1600, 1});
+    ndarray<float> y({1600, 1});
+    for (int i = 0; i < 1600; i++) {
+        x.set(i, 0, i);
+        y.set(i, 0, i % 2 == 0 ? 1 : 0);
+    }
+    std::vector<double> none;
+    fitAndReport("GD 10000 epochs", x, y, none, Solver::GradientDescent, 10000, 0.0001f);
+    fitAndReport("Newton", x, y, none, Solver::Newton, 100, 0.0f);
+    fitAndReport("L-BFGS", x, y, none, Solver::LBFGS, 100, 0.0f);
+}
+
+int main() {
+    compare(100000, 8, 1000);
+    compare(20000, 200, 300);
+    compareMain();
+    return 0;
+}
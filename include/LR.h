@@ -3,8 +3,83 @@
 
 
 #include <ndarray.h>
+#include <optim.h>
+#include <dataset.h>
 #include <iostream>
 #include <math.h>
+#include <vector>
+#include <random>
+#include <numeric>
+#include <algorithm>
+#include <limits>
+
+// Run one epoch as a sequence of gradient steps, step(x_batch, y_batch, shard).
+// With batchSize 0 (or at least the number of rows) it is a single step on
+// the whole dataset. Otherwise the rows are visited in a fresh random order
+// every epoch: `order` is a permutation of the row indices shuffled in place,
+// the dataset itself is never reordered. Each batch is gathered into
+// contiguous buffers that are reused for every batch.
+//
+// Within a step the rows are already sharded over the thread pool (see
+// NDArray::forwardBackward). With hogwild set, the batches themselves are
+// split into one contiguous run per thread instead, and the threads call
+// step concurrently, each with its own shard index, so the model's updates
+// race without locks (Hogwild). Steps must then only touch state shared
+// between shards through element-wise updates of preallocated arrays.
+template<typename T, typename F>
+void forEachBatch(const ndarray<T>& x, const ndarray<T>& y, int batchSize,
+                  std::vector<long>& order, std::mt19937& rng, F step, bool hogwild = false) {
+    long n = x.shape()[0];
+    if (batchSize <= 0 || batchSize >= n) {
+        step(x, y, 0);
+        return;
+    }
+    if ((long)order.size() != n) {
+        order.resize(n);
+        std::iota(order.begin(), order.end(), 0);
+    }
+    std::shuffle(order.begin(), order.end(), rng);
+
+    long batches = (n + batchSize - 1) / batchSize;
+    int shards = hogwild ? (int)std::min((long)parallel::getNumThreads(), batches) : 1;
+    // workers take their buffers from the same allocator as the caller
+    std::shared_ptr<alloc::Allocator> allocator = alloc::current();
+    parallel::ThreadPool::instance().run(shards, shards, [&](int shard) {
+        alloc::Scope scope(allocator);
+        dims::Dims x_shape = x.shape();
+        dims::Dims y_shape = y.shape();
+        x_shape[0] = batchSize;
+        y_shape[0] = batchSize;
+        ndarray<T> x_batch(x_shape);
+        ndarray<T> y_batch(y_shape);
+        for (long batch = shard * batches / shards; batch < (shard + 1) * batches / shards; batch++) {
+            long start = batch * batchSize;
+            long rows = std::min((long)batchSize, n - start);
+            // the last batch may be shorter, use the leading rows of the buffers
+            ndarray<T> xb = x_batch.slice(0, 0, rows);
+            ndarray<T> yb = y_batch.slice(0, 0, rows);
+            xb.gatherRows(x, order, start);
+            yb.gatherRows(y, order, start);
+            step(xb, yb, shard);
+        }
+    });
+}
+
+// how fit() finds the weights
+enum class Solver {
+    // epochs of (mini-batch) gradient descent
+    GradientDescent,
+    // linear regression only: exact least squares from the normal equations,
+    // one pass over the data
+    NormalEquations,
+    // logistic regression only: Newton's method (IRLS), a weighted Gram
+    // matrix and a Cholesky solve per iteration; for up to a few hundred
+    // features
+    Newton,
+    // logistic regression only: limited-memory BFGS, gradients only; for
+    // many features
+    LBFGS
+};
 
 template<typename T>
 class LinearRegression {
@@ -12,19 +87,42 @@ class LinearRegression {
 public:
     LinearRegression() = default;
     LinearRegression(ndarray<T> x, ndarray<T> y);
-    ndarray<T> predict(ndarray<T> x);
+    ndarray<T> predict(const ndarray<T>& x);
     ndarray<T> getWeights();
     ndarray<T> getBias();
     void fit(ndarray<T> x, ndarray<T> y, int epochs, T lr);
     void fit(int epochs, T lr);
     void fit(int epochs);
     void fit();
+    // gradient descent on rows streamed from disk (see dataset.h), each
+    // chunk split into batches as set with setBatchSize; the weights are
+    // reset if they do not match the stream's features
+    void fit(dataset::Stream<T>& data, int epochs, T lr);
+    void fit(dataset::Stream<T>& data);
     void setWeights(ndarray<T> w);
     void setBias(ndarray<T> b);
     void setX(ndarray<T> x);
     void setY(ndarray<T> y);
     void setLearningRate(T lr);
     void setEpochs(int epochs);
+    // rows per gradient step, 0 for full-batch gradient descent
+    void setBatchSize(int batchSize);
+    // seed of the per-epoch shuffle
+    void setSeed(unsigned seed);
+    // with mini-batches, let every thread run its own share of the batches
+    // and update the weights without locks (Hogwild) instead of splitting
+    // each batch over the threads
+    void setHogwild(bool hogwild);
+    void setSolver(Solver solver);
+    // L2 penalty on the weights (not the bias) for Solver::NormalEquations
+    void setRidge(T ridge);
+    // update rule for gradient descent, plain steps of lr * gradient if unset
+    void setOptimizer(std::shared_ptr<optim::Optimizer<T> > optimizer);
+    // stop once the gradient norm of the mean loss is at most the tolerance
+    void setTolerance(T tolerance);
+    // stop once the loss has not improved by more than minDelta for
+    // `patience` epochs in a row
+    void setEarlyStopping(T minDelta, int patience);
     void setLoss(ndarray<T> loss);
     ndarray<T> getLoss();
     ndarray<T> getLossDerivative();
@@ -38,19 +136,34 @@ private:
     ndarray<T> b;
     ndarray<T> loss;
     ndarray<T> loss_derivative;
-    T lr;
-    int epochs;
-    void updateWeights();
-    void updateBias();
-    void updateLoss();
-    void updateLossDerivative();
+    T lr = 0.01;
+    int epochs = 100;
+    int batchSize = 0;
+    bool hogwild = false;
+    Solver solver = Solver::GradientDescent;
+    T ridge = 0;
+    std::shared_ptr<optim::Optimizer<T> > optimizer;
+    optim::EarlyStopping<T> stopping{T(1e-6)};
+    // mean loss and gradient norm of the last recorded step
+    T stepLoss = 0;
+    T stepGradientNorm = 0;
+    std::mt19937 rng;
+    std::vector<long> order;
+    // one gradient descent step on a batch, loss is left as its residual
+    // when record is set
+    void step(const ndarray<T>& x, const ndarray<T>& y, bool record);
+    // epochs of gradient descent on x and y, or on the chunks of data
+    void descend(dataset::Stream<T>* data);
+    // closed-form fit: Cholesky on the normal equations, QR on the data
+    // when they are too ill-conditioned
+    void solve();
 };
 
 template<typename T>
 LinearRegression<T>::LinearRegression(ndarray<T> x, ndarray<T> y) {
-    this->x = x;
-    this->y = y;
-    this->w = ndarray<T>({x.shape()[1], 1});
+    this->x = std::move(x);
+    this->y = std::move(y);
+    this->w = ndarray<T>({this->x.shape()[1], 1});
     this->b = ndarray<T>({1, 1});
     this->w.random(-1, 1);
     this->b.random(-1, 1);
@@ -61,8 +174,10 @@ LinearRegression<T>::LinearRegression(ndarray<T> x, ndarray<T> y) {
 }
 
 template<typename T>
-ndarray<T> LinearRegression<T>::predict(ndarray<T> x) {
-    return x.matMult(this->w) + this->b.flatten()[0];
+ndarray<T> LinearRegression<T>::predict(const ndarray<T>& x) {
+    ndarray<T> y_pred = x.matMult(this->w);
+    y_pred += this->b;
+    return y_pred;
 }
 
 template<typename T>
@@ -77,8 +192,8 @@ ndarray<T> LinearRegression<T>::getBias() {
 
 template<typename T>
 void LinearRegression<T>::fit(ndarray<T> x, ndarray<T> y, int epochs, T lr) {
-    this->x = x;
-    this->y = y;
+    this->x = std::move(x);
+    this->y = std::move(y);
     this->lr = lr;
     this->epochs = epochs;
     this->fit();
@@ -99,6 +214,46 @@ void LinearRegression<T>::fit(int epochs) {
 
 template<typename T>
 void LinearRegression<T>::fit() {
+    if (this->solver == Solver::NormalEquations) {
+        this->solve();
+        return;
+    }
+    this->descend(nullptr);
+}
+
+template<typename T>
+void LinearRegression<T>::fit(dataset::Stream<T>& data, int epochs, T lr) {
+    this->lr = lr;
+    this->epochs = epochs;
+    this->fit(data);
+}
+
+template<typename T>
+void LinearRegression<T>::fit(dataset::Stream<T>& data) {
+    if (this->solver != Solver::GradientDescent) {
+        throw std::invalid_argument("Only gradient descent trains on a stream");
+    }
+    if (this->w.rank() != 2 || this->w.shape()[0] != data.features()) {
+        this->w = ndarray<T>({data.features(), 1});
+        this->b = ndarray<T>({1, 1});
+        this->w.random(-1, 1);
+        this->b.random(-1, 1);
+    }
+    this->descend(&data);
+}
+
+template<typename T>
+void LinearRegression<T>::descend(dataset::Stream<T>* data) {
+    // every epoch builds the same temporaries, recycle their buffers
+    alloc::Scope scope(std::make_shared<alloc::Arena>());
+    // Hogwild threads write the weights at once, they must not share them
+    this->w.unshare();
+    this->b.unshare();
+    this->stopping.reset();
+    if (this->optimizer) {
+        this->optimizer->init(0, this->w);
+        this->optimizer->init(1, this->b);
+    }
     for (int i = 0; i < this->epochs; i++) {
         // flush the buffer
         std::cout << std::flush;
@@ -106,31 +261,45 @@ void LinearRegression<T>::fit() {
         std::cout << "\r";
         // print progress
         std::cout << "Epoch: " << i << "/" << this->epochs << std::flush;
-        this->updateLoss();
-        this->updateLossDerivative();
-        this->updateWeights();
-        this->updateBias();
+        auto step = [this](const ndarray<T>& x, const ndarray<T>& y, int shard) {
+            this->step(x, y, shard == 0);
+        };
+        if (data == nullptr) {
+            forEachBatch(this->x, this->y, this->batchSize, this->order, this->rng, step, this->hogwild);
+        }
+        else {
+            // the next chunk is read while this one trains
+            ndarray<T> x;
+            ndarray<T> y;
+            data->rewind();
+            while (data->next(x, y)) {
+                forEachBatch(x, y, this->batchSize, this->order, this->rng, step, this->hogwild);
+            }
+        }
+        if (this->stopping.update(this->stepLoss, this->stepGradientNorm)) {
+            break;
+        }
     }
 }
 
 template<typename T>
 void LinearRegression<T>::setWeights(ndarray<T> w) {
-    this->w = w;
+    this->w = std::move(w);
 }
 
 template<typename T>
 void LinearRegression<T>::setBias(ndarray<T> b) {
-    this->b = b;
+    this->b = std::move(b);
 }
 
 template<typename T>
 void LinearRegression<T>::setX(ndarray<T> x) {
-    this->x = x;
+    this->x = std::move(x);
 }
 
 template<typename T>
 void LinearRegression<T>::setY(ndarray<T> y) {
-    this->y = y;
+    this->y = std::move(y);
 }
 
 template<typename T>
@@ -144,47 +313,136 @@ void LinearRegression<T>::setEpochs(int epochs) {
 }
 
 template<typename T>
-void LinearRegression<T>::setLoss(ndarray<T> loss) {
-    this->loss = loss;
+void LinearRegression<T>::setBatchSize(int batchSize) {
+    this->batchSize = batchSize;
 }
 
 template<typename T>
-ndarray<T> LinearRegression<T>::getLoss() {
-    return this->loss;
+void LinearRegression<T>::setSeed(unsigned seed) {
+    this->rng.seed(seed);
 }
 
 template<typename T>
-ndarray<T> LinearRegression<T>::getLossDerivative() {
-    return this->loss_derivative;
+void LinearRegression<T>::setHogwild(bool hogwild) {
+    this->hogwild = hogwild;
 }
 
 template<typename T>
-ndarray<T> LinearRegression<T>::predict() {
-    return this->predict(this->x);
+void LinearRegression<T>::setSolver(Solver solver) {
+    if (solver != Solver::GradientDescent && solver != Solver::NormalEquations) {
+        throw std::invalid_argument("Solver not supported by LinearRegression");
+    }
+    this->solver = solver;
+}
+
+template<typename T>
+void LinearRegression<T>::setRidge(T ridge) {
+    this->ridge = ridge;
 }
 
+template<typename T>
+void LinearRegression<T>::setOptimizer(std::shared_ptr<optim::Optimizer<T> > optimizer) {
+    this->optimizer = std::move(optimizer);
+}
 
 template<typename T>
-void LinearRegression<T>::updateWeights() {
-    ndarray<T> dw = this->x.transpose().matMult(this->loss_derivative);
-    this->w -= dw * this->lr;
+void LinearRegression<T>::setTolerance(T tolerance) {
+    this->stopping.setTolerance(tolerance);
 }
 
 template<typename T>
-void LinearRegression<T>::updateBias() {
-    this->b -= this->loss_derivative.sum() * this->lr;
+void LinearRegression<T>::setEarlyStopping(T minDelta, int patience) {
+    this->stopping.setPatience(minDelta, patience);
 }
 
 template<typename T>
-void LinearRegression<T>::updateLoss() {
-    this->loss = this->predict() - this->y;
+void LinearRegression<T>::setLoss(ndarray<T> loss) {
+    this->loss = std::move(loss);
 }
 
 template<typename T>
-void LinearRegression<T>::updateLossDerivative() {
-    this->loss_derivative = this->loss;
+ndarray<T> LinearRegression<T>::getLoss() {
+    return this->loss;
 }
 
+template<typename T>
+ndarray<T> LinearRegression<T>::getLossDerivative() {
+    return this->loss_derivative;
+}
+
+template<typename T>
+ndarray<T> LinearRegression<T>::predict() {
+    return this->predict(this->x);
+}
+
+
+template<typename T>
+void LinearRegression<T>::step(const ndarray<T>& x, const ndarray<T>& y, bool record) {
+    T bias = this->b[0];
+    T sums[2];
+    ndarray<T> residual;
+    // residual and x^T * dL in one sweep over x
+    ndarray<T> dw = x.forwardBackward(this->w, record ? this->loss : residual,
+        [&](ndarray<T>& z, long start) {
+            z += bias;
+            z -= y.slice(0, start, start + z.shape()[0]);
+        }, sums);
+    if (record) {
+        long n = x.shape()[0];
+        this->loss_derivative = this->loss;
+        this->stepLoss = sums[1] / n;
+        this->stepGradientNorm = std::sqrt(dw.dot(dw) + sums[0] * sums[0]) / n;
+    }
+    if (this->optimizer) {
+        this->optimizer->update(0, this->w, dw, this->lr);
+        this->optimizer->update(1, this->b, ndarray<T>({1, 1}, {sums[0]}), this->lr);
+        return;
+    }
+    this->w.axpy(-this->lr, dw);
+    this->b -= sums[0] * this->lr;
+}
+
+template<typename T>
+void LinearRegression<T>::solve() {
+    long n = this->x.shape()[0];
+    int d = (int)this->x.shape()[1];
+    int k = d + 1;
+    // [X 1 y]^T [X 1 y] in one pass over the data
+    std::vector<T> gram = this->x.gramWithIntercept(this->y).toVector();
+    std::vector<T> a(k * k);
+    std::vector<T> beta(k);
+    for (int i = 0; i < k; i++) {
+        std::copy(gram.begin() + i * (d + 2), gram.begin() + i * (d + 2) + k, a.begin() + i * k);
+        beta[i] = gram[i * (d + 2) + d + 1];
+    }
+    // the penalty is on the weights, not the bias
+    for (int i = 0; i < d; i++) {
+        a[i * k + i] += this->ridge;
+    }
+    if (!linalg::solveSPD(k, a, beta.data())) {
+        // least squares on [X 1; sqrt(ridge) I 0] against [y; 0] directly,
+        // column-major as QR wants it
+        long m = n + (this->ridge > 0 ? d : 0);
+        std::vector<T> design((size_t)m * k, T(0));
+        std::vector<T> columns = this->x.transpose().toVector();
+        for (int j = 0; j < d; j++) {
+            std::copy(columns.begin() + (size_t)j * n, columns.begin() + (size_t)(j + 1) * n,
+                      design.begin() + (size_t)j * m);
+        }
+        std::fill(design.begin() + (size_t)d * m, design.begin() + (size_t)d * m + n, T(1));
+        for (int j = 0; j < m - n; j++) {
+            design[(size_t)j * m + n + j] = std::sqrt(this->ridge);
+        }
+        std::vector<T> rhs = this->y.toVector();
+        rhs.resize(m, T(0));
+        linalg::qrLeastSquares(m, k, design.data(), rhs.data(), beta.data());
+    }
+    this->w = ndarray<T>({d, 1}, std::vector<T>(beta.begin(), beta.begin() + d));
+    this->b = ndarray<T>({1, 1}, {beta[d]});
+    this->loss = this->predict();
+    this->loss -= this->y;
+    this->loss_derivative = this->loss;
+}
 
 template<typename T>
 float LinearRegression<T>::MSE() {
@@ -199,50 +457,97 @@ float LinearRegression<T>::MSE() {
 template<typename T>
 class LogisticRegression {
 public:
+    LogisticRegression() = default;
     LogisticRegression(ndarray<T> x, ndarray<T> y);
-    ndarray<T> predict(ndarray<T> x);
+    ndarray<T> predict(const ndarray<T>& x);
     ndarray<T> getWeights();
     ndarray<T> getBias();
     void fit(ndarray<T> x, ndarray<T> y, int epochs, T lr);
     void fit(int epochs, T lr);
     void fit(int epochs);
     void fit();
+    // gradient descent on rows streamed from disk (see dataset.h), each
+    // chunk split into batches as set with setBatchSize; the weights are
+    // reset if they do not match the stream's features
+    void fit(dataset::Stream<T>& data, int epochs, T lr);
+    void fit(dataset::Stream<T>& data);
     void setWeights(ndarray<T> w);
     void setBias(ndarray<T> b);
     void setX(ndarray<T> x);
     void setY(ndarray<T> y);
     void setLearningRate(T lr);
     void setEpochs(int epochs);
+    // rows per gradient step, 0 for full-batch gradient descent
+    void setBatchSize(int batchSize);
+    // seed of the per-epoch shuffle
+    void setSeed(unsigned seed);
+    // with mini-batches, let every thread run its own share of the batches
+    // and update the weights without locks (Hogwild) instead of splitting
+    // each batch over the threads
+    void setHogwild(bool hogwild);
+    // Newton and LBFGS run for at most `epochs` iterations, like gradient
+    // descent they stop early as set below
+    void setSolver(Solver solver);
+    // correction pairs kept by LBFGS
+    void setHistory(int history);
+    // update rule for gradient descent, plain steps of lr * gradient if unset
+    void setOptimizer(std::shared_ptr<optim::Optimizer<T> > optimizer);
+    // stop once the gradient norm of the mean loss is at most the tolerance
+    void setTolerance(T tolerance);
+    // stop once the loss has not improved by more than minDelta for
+    // `patience` epochs in a row
+    void setEarlyStopping(T minDelta, int patience);
     void setLoss(ndarray<T> loss);
     ndarray<T> getLoss();
     ndarray<T> predict();
     ndarray<T> sigmoid(ndarray<T> x);
     float accuracy();
-    float accuracy(ndarray<T> x, ndarray<T> y);
+    float accuracy(const ndarray<T>& x, const ndarray<T>& y);
 
 private:
     ndarray<T> x;
     ndarray<T> y;
     ndarray<T> w;
     ndarray<T> b;
-    T lr;
-    int epochs;
+    T lr = 0.01;
+    int epochs = 100;
     ndarray<T> loss;
-    void updateWeights();
-    void updateBias();
-    void updateLoss();
-    void SGD();
+    int batchSize = 0;
+    bool hogwild = false;
+    Solver solver = Solver::GradientDescent;
+    int history = 10;
+    std::shared_ptr<optim::Optimizer<T> > optimizer;
+    optim::EarlyStopping<T> stopping{T(1e-6)};
+    // mean loss and gradient norm of the last recorded step
+    T stepLoss = 0;
+    T stepGradientNorm = 0;
+    std::mt19937 rng;
+    std::vector<long> order;
+    // one gradient descent step on a batch: a single forward pass, then
+    // weight and bias gradients (and the loss when record is set) from its
+    // residual
+    void step(const ndarray<T>& x, const ndarray<T>& y, bool record);
+    // epochs of gradient descent on x and y, or on the chunks of data
+    void descend(dataset::Stream<T>* data);
+    // mean log-loss of theta = [w; b] on the training data, with its gradient
+    // in grad and sigmoid(x w + b) - y in residual, in one sweep over x
+    T objective(const ndarray<T>& theta, ndarray<T>& grad, ndarray<T>& residual);
+    // solve H d = grad for the Hessian H of the mean log-loss at the point
+    // whose residual is given, damped if H is close to singular
+    ndarray<T> newtonDirection(const ndarray<T>& grad, const ndarray<T>& residual);
+    // Newton or L-BFGS iterations with a backtracking line search
+    void minimize();
 };
 
 template<typename T>
 LogisticRegression<T>::LogisticRegression(ndarray<T> x, ndarray<T> y) {
-    this->x = x;
-    this->y = y;
-    this->w = ndarray<T>({x.shape()[1], 1});
+    this->x = std::move(x);
+    this->y = std::move(y);
+    this->w = ndarray<T>({this->x.shape()[1], 1});
     this->b = ndarray<T>({1, 1});
     this->w.random();
     this->b.random();
-    this->loss = ndarray<T>({x.shape()[0], 1});
+    this->loss = ndarray<T>({this->x.shape()[0], 1});
 }
 
 template<typename T>
@@ -257,8 +562,8 @@ ndarray<T> LogisticRegression<T>::getBias() {
 
 template<typename T>
 void LogisticRegression<T>::fit(ndarray<T> x, ndarray<T> y, int epochs, T lr) {
-    this->x = x;
-    this->y = y;
+    this->x = std::move(x);
+    this->y = std::move(y);
     this->lr = lr;
     this->epochs = epochs;
     this->fit();
@@ -279,6 +584,46 @@ void LogisticRegression<T>::fit(int epochs) {
 
 template<typename T>
 void LogisticRegression<T>::fit() {
+    if (this->solver != Solver::GradientDescent) {
+        this->minimize();
+        return;
+    }
+    this->descend(nullptr);
+}
+
+template<typename T>
+void LogisticRegression<T>::fit(dataset::Stream<T>& data, int epochs, T lr) {
+    this->lr = lr;
+    this->epochs = epochs;
+    this->fit(data);
+}
+
+template<typename T>
+void LogisticRegression<T>::fit(dataset::Stream<T>& data) {
+    if (this->solver != Solver::GradientDescent) {
+        throw std::invalid_argument("Only gradient descent trains on a stream");
+    }
+    if (this->w.rank() != 2 || this->w.shape()[0] != data.features()) {
+        this->w = ndarray<T>({data.features(), 1});
+        this->b = ndarray<T>({1, 1});
+        this->w.random();
+        this->b.random();
+    }
+    this->descend(&data);
+}
+
+template<typename T>
+void LogisticRegression<T>::descend(dataset::Stream<T>* data) {
+    // every epoch builds the same temporaries, recycle their buffers
+    alloc::Scope scope(std::make_shared<alloc::Arena>());
+    // Hogwild threads write the weights at once, they must not share them
+    this->w.unshare();
+    this->b.unshare();
+    this->stopping.reset();
+    if (this->optimizer) {
+        this->optimizer->init(0, this->w);
+        this->optimizer->init(1, this->b);
+    }
     for (int i = 0; i < this->epochs; i++) {
         // flush the buffer
         std::cout << std::flush;
@@ -286,31 +631,45 @@ void LogisticRegression<T>::fit() {
         std::cout << "\r";
         // print the progress
         std::cout << "Epoch: " << i + 1 << "/" << this->epochs << " - " << (float)(i + 1) / this->epochs * 100 << "%";
-        this->updateLoss();
-        this->SGD();
-        this->updateWeights();
-        this->updateBias();
+        auto step = [this](const ndarray<T>& x, const ndarray<T>& y, int shard) {
+            this->step(x, y, shard == 0);
+        };
+        if (data == nullptr) {
+            forEachBatch(this->x, this->y, this->batchSize, this->order, this->rng, step, this->hogwild);
+        }
+        else {
+            // the next chunk is read while this one trains
+            ndarray<T> x;
+            ndarray<T> y;
+            data->rewind();
+            while (data->next(x, y)) {
+                forEachBatch(x, y, this->batchSize, this->order, this->rng, step, this->hogwild);
+            }
+        }
+        if (this->stopping.update(this->stepLoss, this->stepGradientNorm)) {
+            break;
+        }
     }
 }
 
 template<typename T>
 void LogisticRegression<T>::setWeights(ndarray<T> w) {
-    this->w = w;
+    this->w = std::move(w);
 }
 
 template<typename T>
 void LogisticRegression<T>::setBias(ndarray<T> b) {
-    this->b = b;
+    this->b = std::move(b);
 }
 
 template<typename T>
 void LogisticRegression<T>::setX(ndarray<T> x) {
-    this->x = x;
+    this->x = std::move(x);
 }
 
 template<typename T>
 void LogisticRegression<T>::setY(ndarray<T> y) {
-    this->y = y;
+    this->y = std::move(y);
 }
 
 template<typename T>
@@ -324,82 +683,298 @@ void LogisticRegression<T>::setEpochs(int epochs) {
 }
 
 template<typename T>
-void LogisticRegression<T>::setLoss(ndarray<T> loss) {
-    this->loss = loss;
+void LogisticRegression<T>::setBatchSize(int batchSize) {
+    this->batchSize = batchSize;
 }
 
 template<typename T>
-ndarray<T> LogisticRegression<T>::getLoss() {
-    return this->loss;
+void LogisticRegression<T>::setSeed(unsigned seed) {
+    this->rng.seed(seed);
 }
 
+template<typename T>
+void LogisticRegression<T>::setHogwild(bool hogwild) {
+    this->hogwild = hogwild;
+}
 
 template<typename T>
-ndarray<T> LogisticRegression<T>::predict() {
-    return this->predict(this->x);
+void LogisticRegression<T>::setSolver(Solver solver) {
+    if (solver == Solver::NormalEquations) {
+        throw std::invalid_argument("Solver not supported by LogisticRegression");
+    }
+    this->solver = solver;
 }
 
 template<typename T>
-float LogisticRegression<T>::accuracy() {
-    return this->accuracy(this->x, this->y);
+void LogisticRegression<T>::setOptimizer(std::shared_ptr<optim::Optimizer<T> > optimizer) {
+    this->optimizer = std::move(optimizer);
 }
 
 template<typename T>
-float LogisticRegression<T>::accuracy(ndarray<T> x, ndarray<T> y) {
-    return this->predict(x).round().eq(y).sum() / x.shape()[0];
+void LogisticRegression<T>::setTolerance(T tolerance) {
+    this->stopping.setTolerance(tolerance);
+}
+
+template<typename T>
+void LogisticRegression<T>::setEarlyStopping(T minDelta, int patience) {
+    this->stopping.setPatience(minDelta, patience);
 }
 
 template<typename T>
-void LogisticRegression<T>::updateWeights() {
-    ndarray<T> x_transpose = this->x.transpose();
-    ndarray<T> y_pred = this->predict();
-    ndarray<T> y_pred_minus_y = y_pred - this->y;
-    ndarray<T> x_transpose_dot_y = x_transpose.matMult(y_pred_minus_y);
-    ndarray<T> x_transpose_dot_y_div_x_shape = x_transpose_dot_y / this->x.shape()[0];
-    ndarray<T> x_transpose_dot_y_div = x_transpose_dot_y_div_x_shape * this->lr;
-    this->w = this->w - x_transpose_dot_y_div;
+void LogisticRegression<T>::setHistory(int history) {
+    this->history = std::max(1, history);
 }
 
 template<typename T>
-void LogisticRegression<T>::updateBias() {
-    ndarray<T> y_pred = this->predict();
-    ndarray<T> y_pred_minus_y = y_pred - this->y;
-    ndarray<T> y_pred_minus_y_sum = y_pred_minus_y.sum(0);
-    ndarray<T> y_pred_minus_y_sum_div = y_pred_minus_y_sum / this->x.shape()[0];
-    ndarray<T> y_pred_minus_y_sum_div_lr = y_pred_minus_y_sum_div * this->lr;
-    this->b = this->b.flatten() - y_pred_minus_y_sum_div_lr;
+void LogisticRegression<T>::setLoss(ndarray<T> loss) {
+    this->loss = std::move(loss);
 }
 
 template<typename T>
-void LogisticRegression<T>::updateLoss() {
-    ndarray<T> y_pred = this->predict();
-    this->loss = this->y - y_pred;
+ndarray<T> LogisticRegression<T>::getLoss() {
+    return this->loss;
 }
 
+
 template<typename T>
-void LogisticRegression<T>::SGD() {
-    ndarray<T> y_pred = this->predict();
-    ndarray<T> y_pred_minus_y = y_pred - this->y;
-    ndarray<T> y_pred_minus_y_square = y_pred_minus_y * y_pred_minus_y;
-    ndarray<T> y_pred_minus_y_square_sum = y_pred_minus_y_square.sum(0);
-    ndarray<T> y_pred_minus_y_square_sum_divide_2 = y_pred_minus_y_square_sum / 2;
-    ndarray<T> y_pred_minus_y_square_sum_divide_2_divide_x_shape_0 = y_pred_minus_y_square_sum_divide_2 / this->x.shape()[0];
-    ndarray<T> loss = y_pred_minus_y_square_sum_divide_2_divide_x_shape_0;
-    this->loss = loss;
+ndarray<T> LogisticRegression<T>::predict() {
+    return this->predict(this->x);
 }
 
 template<typename T>
-ndarray<T> LogisticRegression<T>::predict(ndarray<T> x) {
-    ndarray<T> x_dot_w = x.matMult(this->w);
-    ndarray<T> x_dot_w_plus_b = x_dot_w + this->b.flatten()[0];
-    ndarray<T> x_dot_w_plus_b_sigmoid = sigmoid(x_dot_w_plus_b);
-    return x_dot_w_plus_b_sigmoid;
+float LogisticRegression<T>::accuracy() {
+    return this->accuracy(this->x, this->y);
 }
 
 template<typename T>
-ndarray<T> LogisticRegression<T>::sigmoid(ndarray<T> x) {
-    return ((x * -1).exp() + 1).inv();
+float LogisticRegression<T>::accuracy(const ndarray<T>& x, const ndarray<T>& y) {
+    return this->predict(x).round().eq(y).sum() / x.shape()[0];
 }
 
+template<typename T>
+void LogisticRegression<T>::step(const ndarray<T>& x, const ndarray<T>& y, bool record) {
+    T bias = this->b[0];
+    // sum of the residual and of its squares
+    T sums[2];
+    ndarray<T> y_pred_minus_y;
+    // forward pass, residual and x^T * residual in one sweep over x
+    ndarray<T> x_transpose_dot_y = x.forwardBackward(this->w, y_pred_minus_y,
+        [&](ndarray<T>& z, long start) {
+            z += bias;
+            z = this->sigmoid(std::move(z));
+            z -= y.slice(0, start, start + z.shape()[0]);
+        }, sums);
+    long n = x.shape()[0];
+    T y_pred_minus_y_sum = sums[0];
+    if (record) {
+        this->loss = ndarray<T>({1}, {sums[1] / 2 / n});
+        this->stepLoss = sums[1] / 2 / n;
+        this->stepGradientNorm = std::sqrt(x_transpose_dot_y.dot(x_transpose_dot_y) +
+                                           y_pred_minus_y_sum * y_pred_minus_y_sum) / n;
+    }
+    if (this->optimizer) {
+        x_transpose_dot_y /= T(n);
+        this->optimizer->update(0, this->w, x_transpose_dot_y, this->lr);
+        this->optimizer->update(1, this->b, ndarray<T>({1, 1}, {y_pred_minus_y_sum / n}), this->lr);
+        return;
+    }
+    // scale and subtract in one pass, written straight into w
+    this->w -= x_transpose_dot_y / n * this->lr;
+    this->b -= y_pred_minus_y_sum / n * this->lr;
+}
+
+template<typename T>
+T LogisticRegression<T>::objective(const ndarray<T>& theta, ndarray<T>& grad, ndarray<T>& residual) {
+    long n = this->x.shape()[0];
+    int d = (int)this->x.shape()[1];
+    T bias = theta.at(d, 0);
+    // sum of the residual, of its squares, and of the log-loss
+    T sums[3];
+    ndarray<T> dw = this->x.forwardBackward(theta.slice(0, 0, d), residual,
+        [&](ndarray<T>& z, long start) -> T {
+            z += bias;
+            ndarray<T> y = this->y.slice(0, start, start + z.shape()[0]);
+            // log(1 + e^z) - y z = -(logSigmoid(-z) + y z), which cannot overflow
+            T loss = -((z * T(-1)).logSigmoid() + z * y).sum();
+            z = this->sigmoid(std::move(z));
+            z -= y;
+            return loss;
+        }, sums);
+    dw /= T(n);
+    ndarray<T> dw_view = grad.slice(0, 0, d);
+    dw_view.copy(dw);
+    grad.set(d, 0, sums[0] / n);
+    return sums[2] / n;
+}
+
+template<typename T>
+ndarray<T> LogisticRegression<T>::newtonDirection(const ndarray<T>& grad, const ndarray<T>& residual) {
+    long n = this->x.shape()[0];
+    int d = (int)this->x.shape()[1];
+    int k = d + 1;
+    // H = [x 1]^T S [x 1] / n with S = p (1 - p), p = residual + y
+    ndarray<T> p = residual + this->y;
+    ndarray<T> s = p * (p * T(-1) + T(1));
+    std::vector<T> gram = this->x.gramWithIntercept(this->y, s).toVector();
+    std::vector<T> h(k * k);
+    T trace = 0;
+    for (int i = 0; i < k; i++) {
+        for (int j = 0; j < k; j++) {
+            h[i * k + j] = gram[i * (d + 2) + j] / n;
+        }
+        trace += h[i * k + i];
+    }
+    std::vector<T> g = ndarray<T>(grad).toVector();
+    // (nearly) separable data drive p (1 - p) to zero, add a growing
+    // multiple of the identity until the system is safely definite
+    T damping = 0;
+    for (int attempt = 0; attempt < 40; attempt++) {
+        std::vector<T> a = h;
+        std::vector<T> direction = g;
+        for (int i = 0; i < k; i++) {
+            a[i * k + i] += damping;
+        }
+        if (linalg::solveSPD(k, a, direction.data())) {
+            return ndarray<T>({k, 1}, direction);
+        }
+        damping = damping == 0 ? std::sqrt(std::numeric_limits<T>::epsilon()) * std::max(trace / k, T(1))
+                               : damping * 10;
+    }
+    // not even the damped Hessian helps, fall back to the gradient
+    return ndarray<T>(grad);
+}
+
+template<typename T>
+void LogisticRegression<T>::minimize() {
+    long n = this->x.shape()[0];
+    int d = (int)this->x.shape()[1];
+    int k = d + 1;
+    alloc::Scope scope(std::make_shared<alloc::Arena>());
+    ndarray<T> theta({k, 1});
+    ndarray<T> w_view = theta.slice(0, 0, d);
+    w_view.copy(this->w);
+    theta.set(d, 0, this->b[0]);
+    ndarray<T> grad({k, 1});
+    ndarray<T> residual;
+    ndarray<T> trial({k, 1});
+    ndarray<T> trial_grad({k, 1});
+    ndarray<T> trial_residual;
+    ndarray<T> direction({k, 1});
+    ndarray<T> s_new({k, 1});
+    ndarray<T> y_new({k, 1});
+    T f = this->objective(theta, grad, residual);
+
+    // L-BFGS correction pairs s = theta' - theta, y = grad' - grad in a ring
+    int m = this->solver == Solver::LBFGS ? this->history : 0;
+    std::vector<ndarray<T> > s_history(m, ndarray<T>({k, 1}));
+    std::vector<ndarray<T> > y_history(m, ndarray<T>({k, 1}));
+    std::vector<T> rho(m);
+    std::vector<T> alpha(m);
+    int pairs = 0;
+    int newest = -1;
+    T gamma = 1;
+
+    this->stopping.reset();
+    for (int i = 0; i < this->epochs; i++) {
+        T grad_norm = std::sqrt(grad.dot(grad));
+        std::cout << "\r" << "Iteration: " << i + 1 << "/" << this->epochs
+                  << " - gradient norm " << grad_norm << std::flush;
+        if (this->stopping.update(f, grad_norm)) {
+            break;
+        }
+        if (this->solver == Solver::Newton) {
+            direction = this->newtonDirection(grad, residual);
+        }
+        else {
+            // two-loop recursion: direction = H grad for the L-BFGS inverse
+            // Hessian estimate H
+            direction = grad;
+            for (int j = 0; j < pairs; j++) {
+                int slot = (newest - j + m) % m;
+                alpha[slot] = rho[slot] * s_history[slot].dot(direction);
+                direction.axpy(-alpha[slot], y_history[slot]);
+            }
+            direction *= pairs > 0 ? gamma : T(1) / std::max(T(1), grad_norm);
+            for (int j = pairs - 1; j >= 0; j--) {
+                int slot = (newest - j + m) % m;
+                T beta = rho[slot] * y_history[slot].dot(direction);
+                direction.axpy(alpha[slot] - beta, s_history[slot]);
+            }
+        }
+        T slope = grad.dot(direction);
+        if (!(slope > 0)) {
+            // not a descent direction, restart from the gradient
+            direction = grad;
+            direction *= T(1) / std::max(T(1), grad_norm);
+            slope = grad.dot(direction);
+            pairs = 0;
+        }
+
+        // backtrack until the loss decreases enough (Armijo)
+        T t = 1;
+        T f_trial = f;
+        bool accepted = false;
+        for (int tries = 0; tries < 40 && !accepted; tries++, t /= 2) {
+            trial = theta;
+            trial.axpy(-t, direction);
+            f_trial = this->objective(trial, trial_grad, trial_residual);
+            // the strict decrease stops the search once rounding hides it
+            accepted = f_trial < f && f_trial <= f - T(1e-4) * t * slope;
+        }
+        if (!accepted) {
+            // no further decrease at this precision
+            break;
+        }
+        if (m > 0) {
+            s_new = trial;
+            s_new -= theta;
+            y_new = trial_grad;
+            y_new -= grad;
+            T sy = s_new.dot(y_new);
+            T yy = y_new.dot(y_new);
+            // keep the estimate positive definite, skip curvature-free pairs
+            if (sy > std::numeric_limits<T>::epsilon() * yy) {
+                int slot = (newest + 1) % m;
+                std::swap(s_history[slot], s_new);
+                std::swap(y_history[slot], y_new);
+                rho[slot] = 1 / sy;
+                gamma = sy / yy;
+                newest = slot;
+                pairs = std::min(pairs + 1, m);
+            }
+        }
+        std::swap(theta, trial);
+        std::swap(grad, trial_grad);
+        std::swap(residual, trial_residual);
+        f = f_trial;
+    }
+    this->w = ndarray<T>(theta.slice(0, 0, d));
+    this->b = ndarray<T>({1, 1}, {theta.at(d, 0)});
+    this->loss = ndarray<T>({1}, {residual.dot(residual) / 2 / n});
+}
+
+template<typename T>
+ndarray<T> LogisticRegression<T>::predict(const ndarray<T>& x) {
+    ndarray<T> z = x.matMult(this->w);
+    z += this->b;
+    return sigmoid(std::move(z));
+}
+
+template<typename T>
+ndarray<T> LogisticRegression<T>::sigmoid(ndarray<T> x) {
+    // one vectorized pass that cannot overflow, written back into x so a
+    // moved-in argument is reused
+    x = x.sigmoid();
+    return x;
+}
+
+// float and double models are compiled once into the regression library
+// (src/regression/LR.cpp), see ALTENSOR_PRECOMPILED in ndarray.h
+#if defined(ALTENSOR_PRECOMPILED_REGRESSION)
+extern template class LinearRegression<float>;
+extern template class LinearRegression<double>;
+extern template class LogisticRegression<float>;
+extern template class LogisticRegression<double>;
+#endif
 
 #endif
@@ -0,0 +1,248 @@
+#ifndef ALLOC_H
+#define ALLOC_H
+
+#include <cstdlib>
+#include <cstdint>
+#include <new>
+#include <memory>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <utility>
+
+// Storage allocation for NDArray buffers.
+//
+// Every NDArray buffer is obtained from the allocator installed for the
+// calling thread. By default that is the heap. A Scope installs another one,
+// typically an Arena, until the scope ends:
+//
+//     std::shared_ptr<alloc::Arena> arena = std::make_shared<alloc::Arena>();
+//     alloc::Scope scope(arena);
+//     ... arrays created here take their storage from the arena ...
+//
+// An Arena keeps the blocks it is given back and hands them out again for
+// requests of the same size, so a loop that creates the same temporaries on
+// every iteration stops touching malloc after the first one. Buffers keep
+// their allocator alive, so arrays may outlive the scope that created them.
+//
+// mallocCount() and mallocBytes() count the blocks actually taken from the
+// system on behalf of arrays, which is how a steady-state loop can be checked
+// to be allocation-free.
+namespace alloc {
+
+// every block is aligned for the widest vector loads
+const std::size_t alignment = 64;
+
+inline std::atomic<long>& mallocCounter() {
+    static std::atomic<long> count(0);
+    return count;
+}
+
+inline std::atomic<long>& mallocByteCounter() {
+    static std::atomic<long> bytes(0);
+    return bytes;
+}
+
+// number of blocks taken from the system for array storage so far
+inline long mallocCount() {
+    return mallocCounter().load();
+}
+
+// total size of those blocks in bytes
+inline long mallocBytes() {
+    return mallocByteCounter().load();
+}
+
+class Allocator {
+    public:
+        virtual ~Allocator() = default;
+        // `bytes` bytes aligned to `alignment`, throws std::bad_alloc
+        virtual void* allocate(std::size_t bytes) = 0;
+        // give back a block from allocate() of the same size
+        virtual void deallocate(void* p, std::size_t bytes) = 0;
+};
+
+// aligned malloc/free, counted
+class Heap : public Allocator {
+    public:
+        void* allocate(std::size_t bytes) {
+            void* raw = std::malloc(bytes + alignment + sizeof(void*));
+            if (raw == nullptr) {
+                throw std::bad_alloc();
+            }
+            std::uintptr_t start = reinterpret_cast<std::uintptr_t>(raw) + sizeof(void*);
+            void* p = reinterpret_cast<void*>((start + alignment - 1) & ~(std::uintptr_t)(alignment - 1));
+            static_cast<void**>(p)[-1] = raw;
+            mallocCounter()++;
+            mallocByteCounter() += (long)bytes;
+            return p;
+        }
+
+        void deallocate(void* p, std::size_t) {
+            if (p != nullptr) {
+                std::free(static_cast<void**>(p)[-1]);
+            }
+        }
+
+        static const std::shared_ptr<Allocator>& instance() {
+            static std::shared_ptr<Allocator> heap = std::make_shared<Heap>();
+            return heap;
+        }
+};
+
+// Caching workspace: freed blocks are kept in a free list per block size and
+// reused, new blocks come from the heap. Thread-safe.
+class Arena : public Allocator {
+    public:
+        Arena() = default;
+        Arena(const Arena&) = delete;
+        Arena& operator=(const Arena&) = delete;
+
+        ~Arena() {
+            for (std::size_t i = 0; i < lists_.size(); i++) {
+                void* p = lists_[i].second;
+                while (p != nullptr) {
+                    void* next = *static_cast<void**>(p);
+                    heap_.deallocate(p, lists_[i].first);
+                    p = next;
+                }
+            }
+        }
+
+        void* allocate(std::size_t bytes) {
+            bytes = roundUp(bytes);
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                void*& head = list(bytes);
+                if (head != nullptr) {
+                    void* p = head;
+                    head = *static_cast<void**>(p);
+                    return p;
+                }
+            }
+            return heap_.allocate(bytes);
+        }
+
+        void deallocate(void* p, std::size_t bytes) {
+            if (p == nullptr) {
+                return;
+            }
+            std::lock_guard<std::mutex> lock(mutex_);
+            void*& head = list(roundUp(bytes));
+            *static_cast<void**>(p) = head;
+            head = p;
+        }
+
+        // put `count` blocks of `bytes` bytes in the cache up front
+        void reserve(std::size_t bytes, int count) {
+            for (int i = 0; i < count; i++) {
+                deallocate(heap_.allocate(roundUp(bytes)), bytes);
+            }
+        }
+
+    private:
+        static std::size_t roundUp(std::size_t bytes) {
+            return bytes == 0 ? alignment : (bytes + alignment - 1) & ~(alignment - 1);
+        }
+
+        void*& list(std::size_t bytes) {
+            for (std::size_t i = 0; i < lists_.size(); i++) {
+                if (lists_[i].first == bytes) {
+                    return lists_[i].second;
+                }
+            }
+            lists_.push_back(std::make_pair(bytes, (void*)nullptr));
+            return lists_.back().second;
+        }
+
+        Heap heap_;
+        std::mutex mutex_;
+        // block size -> head of its free list, linked through the blocks
+        std::vector<std::pair<std::size_t, void*> > lists_;
+};
+
+// allocator used by the calling thread
+inline std::shared_ptr<Allocator>& current() {
+    static thread_local std::shared_ptr<Allocator> allocator = Heap::instance();
+    return allocator;
+}
+
+// install an allocator for the calling thread until the scope ends
+class Scope {
+    public:
+        explicit Scope(std::shared_ptr<Allocator> allocator) : previous_(current()) {
+            current() = std::move(allocator);
+        }
+        ~Scope() {
+            current() = std::move(previous_);
+        }
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        std::shared_ptr<Allocator> previous_;
+};
+
+// std allocator over an Allocator, used for the shared_ptr control blocks so
+// they come from the same place as the elements
+template <typename T>
+struct Adapter {
+    typedef T value_type;
+    std::shared_ptr<Allocator> allocator;
+
+    explicit Adapter(std::shared_ptr<Allocator> allocator) : allocator(std::move(allocator)) {}
+    template <typename U>
+    Adapter(const Adapter<U>& other) : allocator(other.allocator) {}
+
+    T* allocate(std::size_t n) {
+        return static_cast<T*>(allocator->allocate(n * sizeof(T)));
+    }
+    void deallocate(T* p, std::size_t n) {
+        allocator->deallocate(p, n * sizeof(T));
+    }
+};
+
+template <typename T, typename U>
+bool operator==(const Adapter<T>& a, const Adapter<U>& b) {
+    return a.allocator == b.allocator;
+}
+
+template <typename T, typename U>
+bool operator!=(const Adapter<T>& a, const Adapter<U>& b) {
+    return a.allocator != b.allocator;
+}
+
+// uninitialized elements of an array, returned to their allocator on
+// destruction
+template <typename T>
+struct Buffer {
+    T* data;
+    std::size_t size;
+    std::shared_ptr<Allocator> allocator;
+    // memory that must not be written (a read-only file mapping): arrays
+    // copy it before writing, as if it were shared
+    bool readOnly = false;
+
+    Buffer(std::size_t size, std::shared_ptr<Allocator> allocator)
+        : data(static_cast<T*>(allocator->allocate(size * sizeof(T)))), size(size),
+          allocator(std::move(allocator)) {}
+    // take over `size` elements at `data` that belong to `allocator`
+    Buffer(T* data, std::size_t size, std::shared_ptr<Allocator> allocator)
+        : data(data), size(size), allocator(std::move(allocator)) {}
+    ~Buffer() {
+        allocator->deallocate(data, size * sizeof(T));
+    }
+    Buffer(const Buffer&) = delete;
+    Buffer& operator=(const Buffer&) = delete;
+};
+
+// buffer of `size` elements from the calling thread's allocator
+template <typename T>
+std::shared_ptr<Buffer<T> > makeBuffer(std::size_t size) {
+    const std::shared_ptr<Allocator>& allocator = current();
+    return std::allocate_shared<Buffer<T> >(Adapter<Buffer<T> >(allocator), size, allocator);
+}
+
+} // namespace alloc
+
+#endif
@@ -0,0 +1,194 @@
+#ifndef CPU_H
+#define CPU_H
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+
+// Run-time choice of instruction set for the hot kernels.
+//
+// The library is header-only and built with the compiler's default flags, so
+// a plain x86-64 build only uses SSE2. To get more from newer CPUs without
+// building for one of them, the hot kernels (the matrix products, the fused
+// element-wise loop and the reductions, and so exp, sigmoid and friends
+// inlined into them) are compiled once per level below with GCC's target
+// attribute, and dispatch() calls the one for the level in use:
+//
+//     Baseline   whatever the build targets (SSE2 on x86-64)
+//     SSE42      SSE4.2, enough to vectorize the double exp/log kernels
+//     AVX2       AVX2 and FMA, 256-bit matrix micro-kernels
+//     AVX512     AVX-512F and FMA, 512-bit matrix micro-kernels
+//
+// The level in use is getIsa(): the best one the CPU supports, as found with
+// CPUID at startup, unless the ALTENSOR_ISA environment variable (baseline,
+// sse4.2, avx2 or avx512) or setIsa() asks for a lower one, e.g. to compare
+// paths or test the fallbacks. A level the CPU lacks is never used, and
+// neither is one below what the build already targets (an ALTENSOR_NATIVE
+// build has nothing to dispatch). Results can differ between levels in the
+// last bits, as FMA contracts a * b + c into one rounding.
+//
+// Dispatch needs GCC or Clang on x86; elsewhere, or with ALTENSOR_NO_DISPATCH
+// defined, every kernel is compiled once for the build's target.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(__AVX512F__) \
+    && !defined(ALTENSOR_NO_DISPATCH)
+#define ALTENSOR_DISPATCH 1
+#endif
+
+// target attribute of a function that uses intrinsics beyond the build's flags
+#if defined(ALTENSOR_DISPATCH)
+#define ALTENSOR_TARGET(isa) __attribute__((target(isa)))
+#else
+#define ALTENSOR_TARGET(isa)
+#endif
+
+namespace cpu {
+
+enum class Isa { Baseline, SSE42, AVX2, AVX512 };
+
+// the level the build itself targets, always available
+#if defined(__AVX512F__) && defined(__FMA__)
+const Isa compiledIsa = Isa::AVX512;
+#elif defined(__AVX2__) && defined(__FMA__)
+const Isa compiledIsa = Isa::AVX2;
+#elif defined(__SSE4_2__)
+const Isa compiledIsa = Isa::SSE42;
+#else
+const Isa compiledIsa = Isa::Baseline;
+#endif
+
+inline const char* isaName(Isa isa) {
+    switch (isa) {
+        case Isa::SSE42: return "sse4.2";
+        case Isa::AVX2: return "avx2";
+        case Isa::AVX512: return "avx512";
+        default: return "baseline";
+    }
+}
+
+// the best level this CPU (and OS) supports
+inline Isa detectIsa() {
+#if defined(ALTENSOR_DISPATCH)
+    __builtin_cpu_init();
+    bool fma = __builtin_cpu_supports("fma");
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx2") && fma) {
+        return Isa::AVX512;
+    }
+    if (__builtin_cpu_supports("avx2") && fma) {
+        return Isa::AVX2;
+    }
+    if (__builtin_cpu_supports("sse4.2")) {
+        return Isa::SSE42;
+    }
+#endif
+    return compiledIsa;
+}
+
+inline Isa detectedIsa() {
+    static const Isa isa = detectIsa();
+    return isa;
+}
+
+// isa clamped to what can run: at most the CPU's level, at least the build's
+inline Isa usableIsa(Isa isa) {
+    if (isa > detectedIsa()) {
+        isa = detectedIsa();
+    }
+    return isa < compiledIsa ? compiledIsa : isa;
+}
+
+inline Isa defaultIsa() {
+    const char* env = std::getenv("ALTENSOR_ISA");
+    if (env != nullptr) {
+        for (int l = (int)Isa::Baseline; l <= (int)Isa::AVX512; l++) {
+            if (std::strcmp(env, isaName((Isa)l)) == 0) {
+                return usableIsa((Isa)l);
+            }
+        }
+    }
+    return detectedIsa();
+}
+
+inline std::atomic<int>& globalIsa() {
+    static std::atomic<int> isa((int)defaultIsa());
+    return isa;
+}
+
+// use `isa` for every kernel called from now on, clamped as above
+inline void setIsa(Isa isa) {
+    globalIsa() = (int)usableIsa(isa);
+}
+
+inline Isa getIsa() {
+    return (Isa)globalIsa().load(std::memory_order_relaxed);
+}
+
+// Target<L>::call<K>(args...) is K::run<L>(args...) compiled for level L:
+// K::run and everything it calls is inlined into one function with L's
+// instruction set enabled. Nothing inside may hand vector registers to a
+// function compiled for another level, so only pointers and scalars cross.
+// A kernel that dispatches again (an expression evaluated inside a gemm
+// block, say) calls the inner clone instead of inlining all of them.
+template <Isa L>
+struct Target {
+    template <typename K, typename... A>
+    static auto call(A&&... a) -> decltype(K::template run<L>(std::forward<A>(a)...)) {
+        return K::template run<L>(std::forward<A>(a)...);
+    }
+};
+
+#if defined(ALTENSOR_DISPATCH)
+template <>
+struct Target<Isa::Baseline> {
+    template <typename K, typename... A>
+    __attribute__((noinline))
+    static auto call(A&&... a) -> decltype(K::template run<Isa::Baseline>(std::forward<A>(a)...)) {
+        return K::template run<Isa::Baseline>(std::forward<A>(a)...);
+    }
+};
+
+template <>
+struct Target<Isa::SSE42> {
+    template <typename K, typename... A>
+    __attribute__((target("sse4.2,popcnt"), flatten, noinline))
+    static auto call(A&&... a) -> decltype(K::template run<Isa::SSE42>(std::forward<A>(a)...)) {
+        return K::template run<Isa::SSE42>(std::forward<A>(a)...);
+    }
+};
+
+template <>
+struct Target<Isa::AVX2> {
+    template <typename K, typename... A>
+    __attribute__((target("avx2,fma"), flatten, noinline))
+    static auto call(A&&... a) -> decltype(K::template run<Isa::AVX2>(std::forward<A>(a)...)) {
+        return K::template run<Isa::AVX2>(std::forward<A>(a)...);
+    }
+};
+
+template <>
+struct Target<Isa::AVX512> {
+    template <typename K, typename... A>
+    __attribute__((target("avx512f,avx2,fma"), flatten, noinline))
+    static auto call(A&&... a) -> decltype(K::template run<Isa::AVX512>(std::forward<A>(a)...)) {
+        return K::template run<Isa::AVX512>(std::forward<A>(a)...);
+    }
+};
+#endif
+
+// K::run<L>(args...) for the level L in use, compiled for that level
+template <typename K, typename... A>
+auto dispatch(A&&... a) -> decltype(K::template run<compiledIsa>(std::forward<A>(a)...)) {
+#if defined(ALTENSOR_DISPATCH)
+    switch (getIsa()) {
+        case Isa::AVX512: return Target<Isa::AVX512>::template call<K>(std::forward<A>(a)...);
+        case Isa::AVX2: return Target<Isa::AVX2>::template call<K>(std::forward<A>(a)...);
+        case Isa::SSE42: return Target<Isa::SSE42>::template call<K>(std::forward<A>(a)...);
+        default: break;
+    }
+#endif
+    return Target<compiledIsa>::template call<K>(std::forward<A>(a)...);
+}
+
+} // namespace cpu
+
+#endif
@@ -0,0 +1,397 @@
+#ifndef DATASET_H
+#define DATASET_H
+
+#include <cstdlib>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <stdexcept>
+
+#include <ndarray.h>
+#include <npy.h>
+
+// Training data read from disk a chunk of rows at a time, for datasets that do
+// not fit in memory.
+//
+// A Source reads rows of features and targets from a file; CsvSource and
+// NpySource are provided. A Stream hands out its rows as chunks of at most
+// `chunkRows` rows while a background thread reads the following chunk into
+// a second buffer, so reading and parsing overlap with whatever is done with
+// the current chunk:
+//
+//     dataset::Stream<double> data(std::make_shared<dataset::CsvSource<double> >("train.csv"), 65536);
+//     LogisticRegression<double> model;
+//     model.fit(data, epochs, lr);
+//
+// Memory use is two chunks, whatever the size of the file.
+namespace dataset {
+
+// rows of features x and targets y read in order from the start
+template <typename T>
+class Source {
+    public:
+        virtual ~Source() = default;
+        // columns of x and of y
+        virtual int features() const = 0;
+        virtual int targets() const = 0;
+        // read up to `rows` rows into the row-major buffers x (rows x
+        // features) and y (rows x targets), return the number read, 0 once
+        // all rows have been read
+        virtual int read(int rows, T* x, T* y) = 0;
+        // go back to the first row
+        virtual void rewind() = 0;
+};
+
+// Delimited text, one row per line: the features followed by the targets,
+// `targets` columns of them. Blank lines are skipped; a first line of column
+// names can be skipped with `header`.
+template <typename T>
+class CsvSource : public Source<T> {
+    public:
+        CsvSource(const std::string& path, int targets = 1, bool header = false, char delimiter = ',')
+            : path_(path), in_(path), header_(header), delimiter_(delimiter), targets_(targets) {
+            if (!in_) {
+                throw std::runtime_error("csv: cannot open " + path);
+            }
+            // the first row gives the number of columns
+            rewind();
+            std::streampos start = in_.tellg();
+            int columns = 0;
+            while (columns == 0 && std::getline(in_, text_)) {
+                columns = countColumns();
+            }
+            if (columns <= targets_) {
+                throw std::invalid_argument("csv: " + path + " has no feature columns");
+            }
+            features_ = columns - targets_;
+            in_.clear();
+            in_.seekg(start);
+        }
+
+        int features() const { return features_; }
+        int targets() const { return targets_; }
+
+        int read(int rows, T* x, T* y) {
+            int n = 0;
+            while (n < rows && std::getline(in_, text_)) {
+                line_++;
+                const char* p = text_.c_str();
+                skipSpace(p);
+                if (*p == '\0') {
+                    continue;
+                }
+                for (int j = 0; j < features_; j++) {
+                    x[(long)n * features_ + j] = field(p, true);
+                }
+                for (int j = 0; j < targets_; j++) {
+                    y[(long)n * targets_ + j] = field(p, j + 1 < targets_);
+                }
+                skipSpace(p);
+                if (*p != '\0') {
+                    throw std::invalid_argument(where() + "more than " + std::to_string(features_ + targets_) +
+                                                " columns");
+                }
+                n++;
+            }
+            return n;
+        }
+
+        void rewind() {
+            in_.clear();
+            in_.seekg(0);
+            line_ = 0;
+            if (header_) {
+                std::getline(in_, text_);
+                line_ = 1;
+            }
+        }
+
+    private:
+        static T parse(const char* p, char** end, float) { return std::strtof(p, end); }
+        static T parse(const char* p, char** end, double) { return std::strtod(p, end); }
+        static T parse(const char* p, char** end, long double) { return std::strtold(p, end); }
+
+        void skipSpace(const char*& p) const {
+            while ((*p == ' ' || *p == '\t' || *p == '\r') && *p != delimiter_) {
+                p++;
+            }
+        }
+
+        // the number at p, then its delimiter if more columns follow
+        T field(const char*& p, bool delimited) {
+            char* end;
+            T value = parse(p, &end, T());
+            if (end == p) {
+                throw std::invalid_argument(where() + "expected a number");
+            }
+            p = end;
+            if (delimited) {
+                skipSpace(p);
+                if (*p != delimiter_) {
+                    throw std::invalid_argument(where() + "fewer than " + std::to_string(features_ + targets_) +
+                                                " columns");
+                }
+                p++;
+            }
+            return value;
+        }
+
+        int countColumns() const {
+            const char* p = text_.c_str();
+            skipSpace(p);
+            if (*p == '\0') {
+                return 0;
+            }
+            int columns = 1;
+            for (; *p != '\0'; p++) {
+                columns += *p == delimiter_;
+            }
+            return columns;
+        }
+
+        std::string where() const {
+            return "csv: " + path_ + ":" + std::to_string(line_) + ": ";
+        }
+
+        std::string path_;
+        std::ifstream in_;
+        std::string text_;
+        bool header_;
+        char delimiter_;
+        int features_ = 0;
+        int targets_;
+        // number of the line last read
+        long line_ = 0;
+};
+
+// A pair of .npy files (see npy.h) with the same number of rows: x of shape
+// (n, features) and y of shape (n,) or (n, targets), in row-major order.
+// Rows are read straight into the chunk buffers.
+template <typename T>
+class NpySource : public Source<T> {
+    public:
+        NpySource(const std::string& xPath, const std::string& yPath) : x_(xPath, true), y_(yPath, false) {
+            if (x_.rows != y_.rows) {
+                throw std::invalid_argument("npy: " + xPath + " and " + yPath + " have different numbers of rows");
+            }
+        }
+
+        int features() const { return x_.columns; }
+        int targets() const { return y_.columns; }
+
+        int read(int rows, T* x, T* y) {
+            int n = (int)std::min<long>(rows, x_.rows - x_.read);
+            x_.take(n, x);
+            y_.take(n, y);
+            return n;
+        }
+
+        void rewind() {
+            x_.rewind();
+            y_.rewind();
+        }
+
+    private:
+        struct File {
+            // x must be a matrix, y may be a vector
+            File(const std::string& path, bool matrix) : path(path), in(path, std::ios::binary) {
+                if (!in) {
+                    throw std::runtime_error("npy: cannot open " + path);
+                }
+                npy::Header header = npy::readHeader(in);
+                npy::checkDescr<T>(header);
+                const std::vector<long long>& shape = header.shape;
+                if (shape.size() != 2 && (matrix || shape.size() != 1)) {
+                    throw std::invalid_argument("npy: " + path + " is not a matrix");
+                }
+                if (header.fortranOrder && shape.size() > 1 && shape[1] > 1) {
+                    throw std::invalid_argument("npy: " + path + " is in column-major order");
+                }
+                offset = header.dataOffset;
+                rows = shape[0];
+                columns = shape.size() > 1 ? (int)shape[1] : 1;
+            }
+
+            void take(int n, T* dst) {
+                std::streamsize bytes = (std::streamsize)n * columns * sizeof(T);
+                in.read(reinterpret_cast<char*>(dst), bytes);
+                if (in.gcount() != bytes) {
+                    throw std::invalid_argument("npy: " + path + " is truncated");
+                }
+                read += n;
+            }
+
+            void rewind() {
+                in.clear();
+                in.seekg(offset);
+                read = 0;
+            }
+
+            std::string path;
+            std::ifstream in;
+            std::size_t offset;
+            long rows;
+            int columns;
+            // rows read so far
+            long read = 0;
+        };
+
+        File x_;
+        File y_;
+};
+
+// Double-buffered chunks from a source. One background thread reads into
+// whichever buffer is not being used, so by the time the current chunk has
+// been processed the next one is usually ready.
+template <typename T>
+class Stream {
+    public:
+        Stream(std::shared_ptr<Source<T> > source, int chunkRows) : source_(std::move(source)) {
+            if (chunkRows <= 0) {
+                throw std::invalid_argument("Chunk size must be positive");
+            }
+            for (int i = 0; i < 2; i++) {
+                slots_[i].x = NDArray<T>({chunkRows, source_->features()});
+                slots_[i].y = NDArray<T>({chunkRows, source_->targets()});
+            }
+            reader_ = std::thread(&Stream::loop, this);
+            rewind();
+        }
+
+        ~Stream() {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stop_ = true;
+            }
+            wake_.notify_all();
+            reader_.join();
+        }
+
+        Stream(const Stream&) = delete;
+        Stream& operator=(const Stream&) = delete;
+
+        int features() const { return source_->features(); }
+        int targets() const { return source_->targets(); }
+        int chunkRows() const { return (int)slots_[0].x.shape()[0]; }
+
+        // start a new pass from the first row; chunks handed out before are
+        // no longer valid
+        void rewind() {
+            std::unique_lock<std::mutex> lock(mutex_);
+            reading_ = false;
+            ready_.wait(lock, [this] { return !busy_; });
+            source_->rewind();
+            for (int i = 0; i < 2; i++) {
+                slots_[i].rows = -1;
+                slots_[i].error = nullptr;
+            }
+            fill_ = 0;
+            take_ = 0;
+            held_ = -1;
+            ended_ = false;
+            reading_ = true;
+            wake_.notify_all();
+        }
+
+        // views of the next chunk's rows, valid until the following call of
+        // next() or rewind(); false at the end of the pass
+        bool next(NDArray<T>& x, NDArray<T>& y) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (held_ >= 0) {
+                // the previous chunk is done with, its buffer can be refilled
+                slots_[held_].rows = -1;
+                held_ = -1;
+                wake_.notify_all();
+            }
+            if (ended_) {
+                return false;
+            }
+            Slot& slot = slots_[take_];
+            ready_.wait(lock, [&] { return slot.rows >= 0; });
+            if (slot.error || slot.rows == 0) {
+                ended_ = true;
+                slot.rows = -1;
+                if (slot.error) {
+                    std::exception_ptr error = slot.error;
+                    slot.error = nullptr;
+                    std::rethrow_exception(error);
+                }
+                return false;
+            }
+            held_ = take_;
+            take_ ^= 1;
+            x = slot.x.slice(0, 0, slot.rows);
+            y = slot.y.slice(0, 0, slot.rows);
+            return true;
+        }
+
+    private:
+        struct Slot {
+            NDArray<T> x;
+            NDArray<T> y;
+            // rows read into the buffers, 0 at the end of the pass, -1 while
+            // free to be filled
+            int rows = -1;
+            std::exception_ptr error;
+        };
+
+        void loop() {
+            std::unique_lock<std::mutex> lock(mutex_);
+            for (;;) {
+                wake_.wait(lock, [this] { return stop_ || (reading_ && slots_[fill_].rows < 0); });
+                if (stop_) {
+                    return;
+                }
+                Slot& slot = slots_[fill_];
+                busy_ = true;
+                lock.unlock();
+                int rows = 0;
+                std::exception_ptr error;
+                try {
+                    // copies of an earlier chunk keep what they saw
+                    slot.x.unshare();
+                    slot.y.unshare();
+                    rows = source_->read(chunkRows(), slot.x.ptr(), slot.y.ptr());
+                }
+                catch (...) {
+                    error = std::current_exception();
+                }
+                lock.lock();
+                busy_ = false;
+                slot.rows = rows;
+                slot.error = error;
+                // nothing more to read in this pass
+                if (rows == 0 || error) {
+                    reading_ = false;
+                }
+                fill_ ^= 1;
+                ready_.notify_all();
+            }
+        }
+
+        std::shared_ptr<Source<T> > source_;
+        Slot slots_[2];
+        std::thread reader_;
+        std::mutex mutex_;
+        // the reader waits on wake_, the consumer on ready_
+        std::condition_variable wake_;
+        std::condition_variable ready_;
+        // next buffer the reader fills, next one handed out, the one handed out
+        int fill_ = 0;
+        int take_ = 0;
+        int held_ = -1;
+        bool reading_ = false;
+        bool busy_ = false;
+        bool ended_ = false;
+        bool stop_ = false;
+};
+
+} // namespace dataset
+
+#endif
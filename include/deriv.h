@@ -13,7 +13,7 @@ template<typename T>
 ndarray<T> square(ndarray<T> x) {
     std::vector<T> x_data = x.toVector();
     std::vector<T> y_data(x_data.size());
-    for (int i = 0; i < x_data.size(); i++) {
+    for (std::size_t i = 0; i < x_data.size(); i++) {
         y_data[i] = x_data[i] * x_data[i];
     }
     return ndarray<T>(x.shape(), y_data);
@@ -23,7 +23,7 @@ template<typename T>
 ndarray<T> relu(ndarray<T> x) {
     std::vector<T> x_data = x.toVector();
     std::vector<T> y_data(x_data.size());
-    for (int i = 0; i < x_data.size(); i++) {
+    for (std::size_t i = 0; i < x_data.size(); i++) {
         y_data[i] = x_data[i] > 0 ? x_data[i] : 0;
     }
     return ndarray<T>(x.shape(), y_data);
@@ -0,0 +1,186 @@
+#ifndef DIMS_H
+#define DIMS_H
+
+#include <cstddef>
+#include <algorithm>
+#include <initializer_list>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Shapes and strides.
+//
+// Every array and view carries a shape and its strides, and every
+// expression node a shape, so storing them in std::vector costs two heap
+// allocations per view and one per node. Dims keeps up to inlineRank of
+// them inside the object and only goes to the heap beyond that, which no
+// array in this library needs in practice. It reads like a
+// std::vector<long> and converts to one.
+namespace dims {
+
+class Dims {
+    public:
+        static const int inlineRank = 8;
+
+        typedef long value_type;
+        typedef long* iterator;
+        typedef const long* const_iterator;
+        typedef std::reverse_iterator<const long*> const_reverse_iterator;
+
+        Dims() {}
+        Dims(std::initializer_list<long> values) {
+            assign(values.begin(), values.end());
+        }
+        Dims(const std::vector<long>& values) {
+            assign(values.begin(), values.end());
+        }
+        explicit Dims(std::size_t size, long value = 0) {
+            resize(size, value);
+        }
+        template <typename It, typename = typename std::enable_if<!std::is_integral<It>::value>::type>
+        Dims(It first, It last) {
+            assign(first, last);
+        }
+        Dims(const Dims& other) {
+            assign(other.begin(), other.end());
+        }
+        Dims(Dims&& other) {
+            *this = std::move(other);
+        }
+        ~Dims() {
+            delete[] heap_;
+        }
+
+        Dims& operator=(const Dims& other) {
+            if (this != &other) {
+                assign(other.begin(), other.end());
+            }
+            return *this;
+        }
+        Dims& operator=(Dims&& other) {
+            if (this == &other) {
+                return *this;
+            }
+            if (other.heap_ != nullptr) {
+                // take over the heap block
+                delete[] heap_;
+                heap_ = other.heap_;
+                capacity_ = other.capacity_;
+                size_ = other.size_;
+                other.heap_ = nullptr;
+                other.capacity_ = inlineRank;
+            }
+            else {
+                assign(other.begin(), other.end());
+            }
+            other.size_ = 0;
+            return *this;
+        }
+
+        operator std::vector<long>() const {
+            return std::vector<long>(begin(), end());
+        }
+
+        std::size_t size() const { return size_; }
+        bool empty() const { return size_ == 0; }
+
+        long* data() { return heap_ != nullptr ? heap_ : inline_; }
+        const long* data() const { return heap_ != nullptr ? heap_ : inline_; }
+        long& operator[](std::size_t i) { return data()[i]; }
+        const long& operator[](std::size_t i) const { return data()[i]; }
+        long& back() { return data()[size_ - 1]; }
+        const long& back() const { return data()[size_ - 1]; }
+
+        iterator begin() { return data(); }
+        iterator end() { return data() + size_; }
+        const_iterator begin() const { return data(); }
+        const_iterator end() const { return data() + size_; }
+        const_reverse_iterator rbegin() const { return const_reverse_iterator(end()); }
+        const_reverse_iterator rend() const { return const_reverse_iterator(begin()); }
+
+        template <typename It>
+        void assign(It first, It last) {
+            std::size_t n = std::distance(first, last);
+            reserve(n);
+            std::copy(first, last, data());
+            size_ = n;
+        }
+
+        void resize(std::size_t size, long value = 0) {
+            reserve(size);
+            if (size > size_) {
+                std::fill(data() + size_, data() + size, value);
+            }
+            size_ = size;
+        }
+
+        void push_back(long value) {
+            reserve(size_ + 1);
+            data()[size_++] = value;
+        }
+
+        iterator insert(const_iterator pos, long value) {
+            std::size_t at = pos - begin();
+            reserve(size_ + 1);
+            long* p = data();
+            std::copy_backward(p + at, p + size_, p + size_ + 1);
+            p[at] = value;
+            size_++;
+            return p + at;
+        }
+
+        void clear() { size_ = 0; }
+
+    private:
+        // room for n values, keeping the first size_
+        void reserve(std::size_t n) {
+            if (n <= capacity_) {
+                return;
+            }
+            long* block = new long[n];
+            std::copy(begin(), end(), block);
+            delete[] heap_;
+            heap_ = block;
+            capacity_ = n;
+        }
+
+        long inline_[inlineRank];
+        // only set beyond inlineRank values
+        long* heap_ = nullptr;
+        std::size_t size_ = 0;
+        std::size_t capacity_ = inlineRank;
+};
+
+inline bool operator==(const Dims& a, const Dims& b) {
+    return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin());
+}
+
+inline bool operator!=(const Dims& a, const Dims& b) {
+    return !(a == b);
+}
+
+// true when every type is an integer, i.e. the arguments can be indices
+template <typename... I>
+struct Indices : std::true_type {};
+
+template <typename I, typename... Rest>
+struct Indices<I, Rest...>
+    : std::integral_constant<bool, std::is_integral<I>::value && Indices<Rest...>::value> {};
+
+// true for one or more integer indices followed by a value convertible to T,
+// the arguments of NDArray<T>::set(i, j, ..., value)
+template <typename T, typename... A>
+struct IndicesThenValue : std::false_type {};
+
+template <typename T, typename I, typename V>
+struct IndicesThenValue<T, I, V>
+    : std::integral_constant<bool, std::is_integral<I>::value && std::is_convertible<V, T>::value> {};
+
+template <typename T, typename I, typename Next, typename V, typename... Rest>
+struct IndicesThenValue<T, I, Next, V, Rest...>
+    : std::integral_constant<bool, std::is_integral<I>::value && IndicesThenValue<T, Next, V, Rest...>::value> {};
+
+} // namespace dims
+
+#endif
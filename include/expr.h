@@ -0,0 +1,477 @@
+#ifndef EXPR_H
+#define EXPR_H
+
+#include <cmath>
+#include <stdexcept>
+#include <type_traits>
+
+#include <cpu.h>
+#include <dims.h>
+#include <reduce.h>
+#include <vmath.h>
+
+template <typename T>
+class NDArray;
+
+// Lazy element-wise expressions over NDArray.
+//
+// The arithmetic operators and the unary functions (exp, log, tanh, sigmoid,
+// abs, pow, ...) do not compute anything, they return a small expression node that
+// remembers its operands. The whole tree is evaluated in one loop when it is
+// assigned to an NDArray (or reduced with sum()), so a chain like
+// ((x * -1).exp() + 1).inv() makes a single pass over memory and never
+// allocates the intermediate arrays.
+//
+// Nodes keep a pointer into the NDArrays they read, so an expression must be
+// consumed in the statement that builds it; do not store one in an `auto`
+// variable that outlives its operands.
+//
+// Every node can be read two ways: coeff(i) by flat index when all of its
+// arrays are contiguous, or row by row for strided views, where seek(idx)
+// moves to the innermost row at outer index idx and inner(j) reads along it.
+//
+// Operands of different shapes are broadcast with NumPy's rules: shapes are
+// matched from the last dimension, and a missing or size-1 dimension is
+// stretched to the other operand's size. Nothing is copied, a broadcast leaf
+// just reads its stretched dimensions with stride 0. Rows whose operands all
+// advance by 0 or 1 element (a row vector added to a matrix, or a column
+// vector, which is constant along each row) run through unit(j), a loop the
+// compiler can vectorize, instead of the general strided inner(j).
+//
+// overlaps(storage, base, strides) tells whether writing an array laid out
+// that way would change an element the node has not read yet, i.e. whether a
+// leaf reads the same storage through a different offset or strides.
+namespace expr {
+
+template <typename E>
+struct Expr;
+
+template <typename X>
+struct Void {
+    typedef void type;
+};
+
+template <typename Op, typename E>
+struct Unary;
+
+template <typename Op, typename L, typename R>
+struct Binary;
+
+template <typename L, typename R, typename Enable = void>
+struct BinaryValue;
+
+template <typename Op, typename L, typename R, typename T = typename BinaryValue<L, R>::type>
+struct BinaryResult;
+
+// operators applied per element
+struct Add { template <typename T> static T apply(T a, T b) { return a + b; } };
+struct Sub { template <typename T> static T apply(T a, T b) { return a - b; } };
+struct Mul { template <typename T> static T apply(T a, T b) { return a * b; } };
+struct Div { template <typename T> static T apply(T a, T b) { return a / b; } };
+struct Eq { template <typename T> static T apply(T a, T b) { return a == b; } };
+
+// transcendental functions come from vmath.h so the loops still vectorize
+struct Exp { template <typename T> VMATH_INLINE T operator()(T x) const { return vmath::exp(x); } };
+struct Log { template <typename T> VMATH_INLINE T operator()(T x) const { return vmath::log(x); } };
+struct Log1p { template <typename T> VMATH_INLINE T operator()(T x) const { return vmath::log1p(x); } };
+struct Tanh { template <typename T> VMATH_INLINE T operator()(T x) const { return vmath::tanh(x); } };
+struct Sigmoid { template <typename T> VMATH_INLINE T operator()(T x) const { return vmath::sigmoid(x); } };
+struct LogSigmoid { template <typename T> VMATH_INLINE T operator()(T x) const { return vmath::logSigmoid(x); } };
+struct Sqrt { template <typename T> T operator()(T x) const { return std::sqrt(x); } };
+struct Abs { template <typename T> T operator()(T x) const { return std::abs(x); } };
+struct Round { template <typename T> T operator()(T x) const { return std::round(x); } };
+struct Inv { template <typename T> T operator()(T x) const { return T(1) / x; } };
+struct Pow {
+    int exponent;
+    template <typename T> T operator()(T x) const { return std::pow(x, exponent); }
+};
+
+// call fn(idx, n) for every innermost row of `shape` in row-major order, idx
+// is the index over the outer dimensions and n the length of the row
+template <typename F>
+void forEachRow(const dims::Dims& shape, F fn) {
+    int rank = shape.size();
+    long n = rank == 0 ? 1 : shape[rank - 1];
+    long rows = 1;
+    for (int d = 0; d + 1 < rank; d++) {
+        rows *= shape[d];
+    }
+    if (n == 0 || rows == 0) {
+        return;
+    }
+    dims::Dims idx(rank > 1 ? rank - 1 : 1, 0);
+    for (long r = 0; r < rows; r++) {
+        fn(idx.data(), n);
+        for (int d = rank - 2; d >= 0; d--) {
+            if (++idx[d] < shape[d]) {
+                break;
+            }
+            idx[d] = 0;
+        }
+    }
+}
+
+// shape of a and b broadcast together, throws if they are incompatible
+inline dims::Dims broadcastShape(const dims::Dims& a, const dims::Dims& b) {
+    const dims::Dims& longer = a.size() >= b.size() ? a : b;
+    const dims::Dims& shorter = a.size() >= b.size() ? b : a;
+    dims::Dims shape = longer;
+    size_t lead = longer.size() - shorter.size();
+    for (size_t d = 0; d < shorter.size(); d++) {
+        long& n = shape[lead + d];
+        if (shorter[d] != n && shorter[d] != 1 && n != 1) {
+            throw std::invalid_argument("Shapes cannot be broadcast together");
+        }
+        n = n == 1 ? shorter[d] : n;
+    }
+    return shape;
+}
+
+// base of every node, E is the node type itself
+template <typename E>
+struct Expr {
+    const E& self() const { return static_cast<const E&>(*this); }
+
+    Unary<Exp, E> exp() const { return Unary<Exp, E>(self(), Exp()); }
+    Unary<Log, E> log() const { return Unary<Log, E>(self(), Log()); }
+    Unary<Log1p, E> log1p() const { return Unary<Log1p, E>(self(), Log1p()); }
+    Unary<Tanh, E> tanh() const { return Unary<Tanh, E>(self(), Tanh()); }
+    Unary<Sigmoid, E> sigmoid() const { return Unary<Sigmoid, E>(self(), Sigmoid()); }
+    Unary<LogSigmoid, E> logSigmoid() const { return Unary<LogSigmoid, E>(self(), LogSigmoid()); }
+    Unary<Sqrt, E> sqrt() const { return Unary<Sqrt, E>(self(), Sqrt()); }
+    Unary<Abs, E> abs() const { return Unary<Abs, E>(self(), Abs()); }
+    Unary<Round, E> round() const { return Unary<Round, E>(self(), Round()); }
+    Unary<Inv, E> inv() const { return Unary<Inv, E>(self(), Inv()); }
+    Unary<Pow, E> pow(int exponent) const {
+        Pow op = {exponent};
+        return Unary<Pow, E>(self(), op);
+    }
+
+    // element-wise equality as 1/0
+    template <typename R>
+    typename BinaryResult<Eq, E, R>::type eq(const R& other) const {
+        return BinaryResult<Eq, E, R>::make(self(), other);
+    }
+
+    // fused reduction, no temporary array; blocked pairwise by default (see
+    // reduce.h), the same bits whatever the layout and thread count
+    template <typename U = E>
+    typename U::value_type sum(reduce::Summation mode = reduce::Summation::Pairwise) const {
+        typedef typename U::value_type T;
+        const E& e = self();
+        if (e.contiguous()) {
+            return reduce::sum<T>(e.size(), [&e](long i) { return e.coeff(i); }, mode);
+        }
+        reduce::Stream<T> s(mode);
+        forEachRow(e.shape(), [&](const long* idx, long n) {
+            e.seek(idx);
+            for (long j = 0; j < n; j++) {
+                s.push(e.inner(j));
+            }
+        });
+        return s.result();
+    }
+
+    // materialize into a new array
+    template <typename U = E>
+    NDArray<typename U::value_type> eval() const {
+        return NDArray<typename U::value_type>(*this);
+    }
+};
+
+// NDArray operand, possibly a strided view, possibly broadcast
+template <typename T>
+struct Leaf : Expr<Leaf<T> > {
+    typedef T value_type;
+    typedef void expr_tag;
+    static const bool scalar = false;
+    const T* data;
+    const void* storage_;
+    long size_;
+    const dims::Dims* shape_;
+    const dims::Dims* strides_;
+    bool contiguous_;
+    // once broadcast: the stretched shape, and strides with 0 for every
+    // stretched dimension; empty otherwise
+    dims::Dims broadcastShape_;
+    dims::Dims broadcastStrides_;
+    mutable const T* row_;
+    long step_;
+
+    explicit Leaf(const NDArray<T>& arr)
+        : data(arr.ptr()), storage_(arr.data ? arr.data->buffer.get() : nullptr), size_(arr.size_), shape_(&arr.shape_), strides_(&arr.strides_),
+          contiguous_(arr.contiguous()), row_(arr.ptr()), step_(arr.strides_.empty() ? 1 : arr.strides_.back()) {}
+    T coeff(long i) const { return data[i]; }
+    long size() const { return size_; }
+    const dims::Dims& shape() const { return broadcastShape_.empty() ? *shape_ : broadcastShape_; }
+    const dims::Dims& strides() const { return broadcastShape_.empty() ? *strides_ : broadcastStrides_; }
+    bool contiguous() const { return contiguous_; }
+    bool unitStride() const { return step_ == 0 || step_ == 1; }
+    void seek(const long* idx) const {
+        const dims::Dims& strides = this->strides();
+        row_ = data;
+        for (int d = 0; d + 1 < (int)strides.size(); d++) {
+            row_ += idx[d] * strides[d];
+        }
+    }
+    T inner(long j) const { return row_[j * step_]; }
+    T unit(long j) const { return step_ == 0 ? *row_ : row_[j]; }
+    // read as if stretched to `shape`, which must be broadcast compatible
+    void broadcast(const dims::Dims& shape) {
+        if (shape == *shape_) {
+            return;
+        }
+        int lead = shape.size() - shape_->size();
+        broadcastShape_ = shape;
+        broadcastStrides_ = dims::Dims(shape.size(), 0);
+        for (int d = lead; d < (int)shape.size(); d++) {
+            if ((*shape_)[d - lead] == shape[d]) {
+                broadcastStrides_[d] = (*strides_)[d - lead];
+            }
+        }
+        size_ = 1;
+        for (size_t d = 0; d < shape.size(); d++) {
+            size_ *= shape[d];
+        }
+        contiguous_ = false;
+        step_ = broadcastStrides_.empty() ? 1 : broadcastStrides_.back();
+    }
+    bool overlaps(const void* storage, const T* base, const dims::Dims& strides) const {
+        return storage == storage_ && (base != data || strides != this->strides());
+    }
+};
+
+// scalar operand, broadcast to every element
+template <typename T>
+struct Scalar : Expr<Scalar<T> > {
+    typedef T value_type;
+    typedef void expr_tag;
+    static const bool scalar = true;
+    T value;
+
+    explicit Scalar(T value) : value(value) {}
+    T coeff(long) const { return value; }
+    long size() const { return 1; }
+    bool contiguous() const { return true; }
+    bool unitStride() const { return true; }
+    void seek(const long*) const {}
+    T inner(long) const { return value; }
+    T unit(long) const { return value; }
+    void broadcast(const dims::Dims&) {}
+    bool overlaps(const void*, const T*, const dims::Dims&) const { return false; }
+    const dims::Dims& shape() const {
+        static const dims::Dims none;
+        return none;
+    }
+};
+
+template <typename Op, typename E>
+struct Unary : Expr<Unary<Op, E> > {
+    typedef typename E::value_type value_type;
+    typedef void expr_tag;
+    static const bool scalar = false;
+    E e;
+    Op op;
+
+    Unary(const E& e, Op op) : e(e), op(op) {}
+    value_type coeff(long i) const { return op(e.coeff(i)); }
+    long size() const { return e.size(); }
+    const dims::Dims& shape() const { return e.shape(); }
+    bool contiguous() const { return e.contiguous(); }
+    bool unitStride() const { return e.unitStride(); }
+    void seek(const long* idx) const { e.seek(idx); }
+    value_type inner(long j) const { return op(e.inner(j)); }
+    value_type unit(long j) const { return op(e.unit(j)); }
+    void broadcast(const dims::Dims& shape) { e.broadcast(shape); }
+    bool overlaps(const void* storage, const value_type* base, const dims::Dims& strides) const {
+        return e.overlaps(storage, base, strides);
+    }
+};
+
+template <typename Op, typename L, typename R>
+struct Binary : Expr<Binary<Op, L, R> > {
+    typedef typename L::value_type value_type;
+    typedef void expr_tag;
+    static const bool scalar = L::scalar && R::scalar;
+    L l;
+    R r;
+    // the broadcast shape when the operands' shapes differ, empty otherwise
+    dims::Dims shape_;
+    long size_;
+
+    Binary(const L& l, const R& r) : l(l), r(r), size_(0) {
+        if (!L::scalar && !R::scalar && l.shape() != r.shape()) {
+            broadcast(broadcastShape(l.shape(), r.shape()));
+        }
+    }
+    value_type coeff(long i) const { return Op::apply(l.coeff(i), r.coeff(i)); }
+    long size() const { return !shape_.empty() ? size_ : L::scalar ? r.size() : l.size(); }
+    const dims::Dims& shape() const { return !shape_.empty() ? shape_ : L::scalar ? r.shape() : l.shape(); }
+    bool contiguous() const { return l.contiguous() && r.contiguous(); }
+    bool unitStride() const { return l.unitStride() && r.unitStride(); }
+    void seek(const long* idx) const {
+        l.seek(idx);
+        r.seek(idx);
+    }
+    value_type inner(long j) const { return Op::apply(l.inner(j), r.inner(j)); }
+    value_type unit(long j) const { return Op::apply(l.unit(j), r.unit(j)); }
+    void broadcast(const dims::Dims& shape) {
+        l.broadcast(shape);
+        r.broadcast(shape);
+        shape_ = shape;
+        size_ = 1;
+        for (size_t d = 0; d < shape.size(); d++) {
+            size_ *= shape[d];
+        }
+    }
+    bool overlaps(const void* storage, const value_type* base, const dims::Dims& strides) const {
+        return l.overlaps(storage, base, strides) || r.overlaps(storage, base, strides);
+    }
+};
+
+// map an operand to its node type: NDArray -> Leaf, node -> itself,
+// arithmetic value -> Scalar of the array's element type
+template <typename X, typename T, typename Enable = void>
+struct Operand {
+    typedef Scalar<T> type;
+    static type make(const X& x) { return type(T(x)); }
+};
+
+template <typename T, typename U>
+struct Operand<NDArray<U>, T> {
+    typedef Leaf<U> type;
+    static type make(const NDArray<U>& x) { return type(x); }
+};
+
+template <typename X, typename T>
+struct Operand<X, T, typename Void<typename X::expr_tag>::type> {
+    typedef X type;
+    static const X& make(const X& x) { return x; }
+};
+
+// element type of an operand, void for plain values
+template <typename X, typename Enable = void>
+struct ValueOf {
+    typedef void type;
+};
+
+template <typename U>
+struct ValueOf<NDArray<U> > {
+    typedef U type;
+};
+
+template <typename X>
+struct ValueOf<X, typename Void<typename X::expr_tag>::type> {
+    typedef typename X::value_type type;
+};
+
+// value type of a binary operation, only defined when at least one side is
+// an array or expression and the other is an array, expression or number
+template <typename L, typename R, typename Enable>
+struct BinaryValue {};
+
+template <typename L, typename R>
+struct BinaryValue<L, R, typename std::enable_if<
+    !std::is_void<typename ValueOf<L>::type>::value &&
+    (!std::is_void<typename ValueOf<R>::type>::value || std::is_arithmetic<R>::value)>::type> {
+    typedef typename ValueOf<L>::type type;
+};
+
+template <typename L, typename R>
+struct BinaryValue<L, R, typename std::enable_if<
+    std::is_void<typename ValueOf<L>::type>::value && std::is_arithmetic<L>::value &&
+    !std::is_void<typename ValueOf<R>::type>::value>::type> {
+    typedef typename ValueOf<R>::type type;
+};
+
+template <typename Op, typename L, typename R, typename T>
+struct BinaryResult {
+    typedef Binary<Op, typename Operand<L, T>::type, typename Operand<R, T>::type> type;
+    static type make(const L& l, const R& r) {
+        return type(Operand<L, T>::make(l), Operand<R, T>::make(r));
+    }
+};
+
+// how evaluate() stores each value into the destination
+struct Assign { template <typename T> void operator()(T& d, T v) const { d = v; } };
+struct AddAssign { template <typename T> void operator()(T& d, T v) const { d += v; } };
+struct SubAssign { template <typename T> void operator()(T& d, T v) const { d -= v; } };
+struct MulAssign { template <typename T> void operator()(T& d, T v) const { d *= v; } };
+struct DivAssign { template <typename T> void operator()(T& d, T v) const { d /= v; } };
+
+// dst op= e over `shape`, the single fused loop every expression ends up in.
+// dst is described by its strides so views can be written through; when dst
+// and every operand are contiguous it is one flat, vectorizable loop.
+template <typename T, typename E, typename Op>
+void evaluateLoop(T* dst, const dims::Dims& shape, const dims::Dims& strides,
+                  bool contiguous, const E& e, Op op) {
+    if (contiguous && e.contiguous()) {
+        long n = 1;
+        for (size_t d = 0; d < shape.size(); d++) {
+            n *= shape[d];
+        }
+        for (long i = 0; i < n; i++) {
+            op(dst[i], e.coeff(i));
+        }
+        return;
+    }
+    long inner = strides.empty() ? 1 : strides.back();
+    // contiguous rows of dst against operands that are contiguous or
+    // constant along the row, e.g. a broadcast row or column vector
+    bool unit = inner == 1 && e.unitStride();
+    forEachRow(shape, [&](const long* idx, long n) {
+        T* row = dst;
+        for (size_t d = 0; d + 1 < strides.size(); d++) {
+            row += idx[d] * strides[d];
+        }
+        e.seek(idx);
+        if (unit) {
+            for (long j = 0; j < n; j++) {
+                op(row[j], e.unit(j));
+            }
+            return;
+        }
+        for (long j = 0; j < n; j++) {
+            op(row[j * inner], e.inner(j));
+        }
+    });
+}
+
+struct EvaluateKernel {
+    template <cpu::Isa L, typename T, typename E, typename Op>
+    static void run(T* dst, const dims::Dims& shape, const dims::Dims& strides,
+                    bool contiguous, const E& e, Op op) {
+        evaluateLoop(dst, shape, strides, contiguous, e, op);
+    }
+};
+
+// evaluateLoop compiled for the instruction set in use (see cpu.h)
+template <typename T, typename E, typename Op>
+void evaluate(T* dst, const dims::Dims& shape, const dims::Dims& strides,
+              bool contiguous, const E& e, Op op) {
+    cpu::dispatch<EvaluateKernel>(dst, shape, strides, contiguous, e, op);
+}
+
+} // namespace expr
+
+template <typename L, typename R>
+typename expr::BinaryResult<expr::Add, L, R>::type operator+(const L& l, const R& r) {
+    return expr::BinaryResult<expr::Add, L, R>::make(l, r);
+}
+
+template <typename L, typename R>
+typename expr::BinaryResult<expr::Sub, L, R>::type operator-(const L& l, const R& r) {
+    return expr::BinaryResult<expr::Sub, L, R>::make(l, r);
+}
+
+template <typename L, typename R>
+typename expr::BinaryResult<expr::Mul, L, R>::type operator*(const L& l, const R& r) {
+    return expr::BinaryResult<expr::Mul, L, R>::make(l, r);
+}
+
+template <typename L, typename R>
+typename expr::BinaryResult<expr::Div, L, R>::type operator/(const L& l, const R& r) {
+    return expr::BinaryResult<expr::Div, L, R>::make(l, r);
+}
+
+#endif
@@ -0,0 +1,812 @@
+#ifndef GEMM_H
+#define GEMM_H
+
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <type_traits>
+
+#include <cpu.h>
+#include <parallel.h>
+
+#if defined(__AVX2__) || defined(__AVX512F__) || defined(ALTENSOR_DISPATCH)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// the AVX kernels are only ever inlined into code compiled for their level
+// (cpu::Target), so no vector register is passed between levels
+#if defined(ALTENSOR_DISPATCH)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpsabi"
+#endif
+
+// Blocked general matrix multiply used by NDArray::matMult
+//
+//     C = alpha * A * B + beta * C
+//
+// A is m x k, B is k x n and C is m x n. Every operand is described by a
+// pointer plus a row stride and a column stride (in elements), so a row-major
+// matrix has (rs, cs) = (cols, 1) and its transpose is the same storage with
+// the strides swapped.
+//
+// The loop nest follows the usual Goto/BLIS layout: B is packed into kc x nc
+// panels that stay in L3, A into mc x kc blocks that stay in L2, and the
+// micro-kernel streams an MR x kc sliver of A and a kc x NR sliver of B from
+// L1 while holding the MR x NR tile of C in registers.
+//
+// Tile sizes and vector types depend on the instruction set level (cpu.h),
+// and the kernels are compiled once per level and picked at run time.
+namespace gemm {
+
+// scalar "vector" used by the generic micro-kernel for any T
+template <typename T>
+struct ScalarVec {
+    typedef T reg;
+    static const int width = 1;
+    static reg zero() { return T(0); }
+    static reg load(const T* p) { return *p; }
+    static reg set1(T v) { return v; }
+    static reg fmadd(reg a, reg b, reg c) { return a * b + c; }
+    static reg mul(reg a, reg b) { return a * b; }
+    static void store(T* p, reg v) { *p = v; }
+    static reg add(reg a, reg b) { return a + b; }
+    static T hsum(reg v) { return v; }
+};
+
+#if defined(__SSE2__)
+struct Sse2Float {
+    typedef __m128 reg;
+    static const int width = 4;
+    static reg zero() { return _mm_setzero_ps(); }
+    static reg load(const float* p) { return _mm_loadu_ps(p); }
+    static reg set1(float v) { return _mm_set1_ps(v); }
+    static reg fmadd(reg a, reg b, reg c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+    static reg mul(reg a, reg b) { return _mm_mul_ps(a, b); }
+    static void store(float* p, reg v) { _mm_storeu_ps(p, v); }
+    static reg add(reg a, reg b) { return _mm_add_ps(a, b); }
+    static float hsum(reg v) {
+        __m128 x = _mm_add_ps(v, _mm_movehl_ps(v, v));
+        x = _mm_add_ss(x, _mm_shuffle_ps(x, x, 1));
+        return _mm_cvtss_f32(x);
+    }
+};
+
+struct Sse2Double {
+    typedef __m128d reg;
+    static const int width = 2;
+    static reg zero() { return _mm_setzero_pd(); }
+    static reg load(const double* p) { return _mm_loadu_pd(p); }
+    static reg set1(double v) { return _mm_set1_pd(v); }
+    static reg fmadd(reg a, reg b, reg c) { return _mm_add_pd(_mm_mul_pd(a, b), c); }
+    static reg mul(reg a, reg b) { return _mm_mul_pd(a, b); }
+    static void store(double* p, reg v) { _mm_storeu_pd(p, v); }
+    static reg add(reg a, reg b) { return _mm_add_pd(a, b); }
+    static double hsum(reg v) {
+        return _mm_cvtsd_f64(_mm_add_sd(v, _mm_unpackhi_pd(v, v)));
+    }
+};
+#endif
+
+#if defined(__AVX2__) || defined(ALTENSOR_DISPATCH)
+struct Avx2Float {
+    typedef __m256 reg;
+    static const int width = 8;
+    ALTENSOR_TARGET("avx2,fma") static reg zero() { return _mm256_setzero_ps(); }
+    ALTENSOR_TARGET("avx2,fma") static reg load(const float* p) { return _mm256_loadu_ps(p); }
+    ALTENSOR_TARGET("avx2,fma") static reg set1(float v) { return _mm256_set1_ps(v); }
+    ALTENSOR_TARGET("avx2,fma") static reg fmadd(reg a, reg b, reg c) { return _mm256_fmadd_ps(a, b, c); }
+    ALTENSOR_TARGET("avx2,fma") static reg mul(reg a, reg b) { return _mm256_mul_ps(a, b); }
+    ALTENSOR_TARGET("avx2,fma") static void store(float* p, reg v) { _mm256_storeu_ps(p, v); }
+    ALTENSOR_TARGET("avx2,fma") static reg add(reg a, reg b) { return _mm256_add_ps(a, b); }
+    ALTENSOR_TARGET("avx2,fma") static float hsum(reg v) {
+        __m128 x = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+        x = _mm_add_ps(x, _mm_movehl_ps(x, x));
+        x = _mm_add_ss(x, _mm_shuffle_ps(x, x, 1));
+        return _mm_cvtss_f32(x);
+    }
+};
+
+struct Avx2Double {
+    typedef __m256d reg;
+    static const int width = 4;
+    ALTENSOR_TARGET("avx2,fma") static reg zero() { return _mm256_setzero_pd(); }
+    ALTENSOR_TARGET("avx2,fma") static reg load(const double* p) { return _mm256_loadu_pd(p); }
+    ALTENSOR_TARGET("avx2,fma") static reg set1(double v) { return _mm256_set1_pd(v); }
+    ALTENSOR_TARGET("avx2,fma") static reg fmadd(reg a, reg b, reg c) { return _mm256_fmadd_pd(a, b, c); }
+    ALTENSOR_TARGET("avx2,fma") static reg mul(reg a, reg b) { return _mm256_mul_pd(a, b); }
+    ALTENSOR_TARGET("avx2,fma") static void store(double* p, reg v) { _mm256_storeu_pd(p, v); }
+    ALTENSOR_TARGET("avx2,fma") static reg add(reg a, reg b) { return _mm256_add_pd(a, b); }
+    ALTENSOR_TARGET("avx2,fma") static double hsum(reg v) {
+        __m128d x = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+        x = _mm_add_sd(x, _mm_unpackhi_pd(x, x));
+        return _mm_cvtsd_f64(x);
+    }
+};
+#endif
+
+#if defined(__AVX512F__) || defined(ALTENSOR_DISPATCH)
+struct Avx512Float {
+    typedef __m512 reg;
+    static const int width = 16;
+    ALTENSOR_TARGET("avx512f,avx2,fma") static reg zero() { return _mm512_setzero_ps(); }
+    ALTENSOR_TARGET("avx512f,avx2,fma") static reg load(const float* p) { return _mm512_loadu_ps(p); }
+    ALTENSOR_TARGET("avx512f,avx2,fma") static reg set1(float v) { return _mm512_set1_ps(v); }
+    ALTENSOR_TARGET("avx512f,avx2,fma") static reg fmadd(reg a, reg b, reg c) { return _mm512_fmadd_ps(a, b, c); }
+    ALTENSOR_TARGET("avx512f,avx2,fma") static reg mul(reg a, reg b) { return _mm512_mul_ps(a, b); }
+    ALTENSOR_TARGET("avx512f,avx2,fma") static void store(float* p, reg v) { _mm512_storeu_ps(p, v); }
+    ALTENSOR_TARGET("avx512f,avx2,fma") static reg add(reg a, reg b) { return _mm512_add_ps(a, b); }
+    ALTENSOR_TARGET("avx512f,avx2,fma") static float hsum(reg v) { return _mm512_reduce_add_ps(v); }
+};
+
+struct Avx512Double {
+    typedef __m512d reg;
+    static const int width = 8;
+    ALTENSOR_TARGET("avx512f,avx2,fma") static reg zero() { return _mm512_setzero_pd(); }
+    ALTENSOR_TARGET("avx512f,avx2,fma") static reg load(const double* p) { return _mm512_loadu_pd(p); }
+    ALTENSOR_TARGET("avx512f,avx2,fma") static reg set1(double v) { return _mm512_set1_pd(v); }
+    ALTENSOR_TARGET("avx512f,avx2,fma") static reg fmadd(reg a, reg b, reg c) { return _mm512_fmadd_pd(a, b, c); }
+    ALTENSOR_TARGET("avx512f,avx2,fma") static reg mul(reg a, reg b) { return _mm512_mul_pd(a, b); }
+    ALTENSOR_TARGET("avx512f,avx2,fma") static void store(double* p, reg v) { _mm512_storeu_pd(p, v); }
+    ALTENSOR_TARGET("avx512f,avx2,fma") static reg add(reg a, reg b) { return _mm512_add_pd(a, b); }
+    ALTENSOR_TARGET("avx512f,avx2,fma") static double hsum(reg v) { return _mm512_reduce_add_pd(v); }
+};
+#endif
+
+// Register tile (MR x NV vectors) and cache block sizes for each type and
+// instruction set level. KC * NR and KC * MR slivers must fit in L1, MC * KC
+// in L2 and KC * NC in L3.
+template <typename T, cpu::Isa L>
+struct Config {
+    typedef ScalarVec<T> Vec;
+    static const int MR = 4;
+    static const int NV = 8;
+    static const int KC = 256;
+    static const int MC = 128;
+    static const int NC = 2048;
+};
+
+// below AVX2 (baseline x86-64 still has SSE2), a wider generic tile lets the
+// compiler vectorize the inner loop of the scalar kernel
+template <cpu::Isa L>
+struct Config<float, L> {
+    typedef ScalarVec<float> Vec;
+    static const int MR = 4;
+    static const int NV = 16;
+    static const int KC = 384;
+    static const int MC = 128;
+    static const int NC = 4096;
+};
+
+template <cpu::Isa L>
+struct Config<double, L> {
+    typedef ScalarVec<double> Vec;
+    static const int MR = 4;
+    static const int NV = 8;
+    static const int KC = 256;
+    static const int MC = 128;
+    static const int NC = 2048;
+};
+
+#if defined(__AVX2__) || defined(ALTENSOR_DISPATCH)
+template <>
+struct Config<float, cpu::Isa::AVX2> {
+    typedef Avx2Float Vec;
+    static const int MR = 6;
+    static const int NV = 2;
+    static const int KC = 384;
+    static const int MC = 120;
+    static const int NC = 4096;
+};
+
+template <>
+struct Config<double, cpu::Isa::AVX2> {
+    typedef Avx2Double Vec;
+    static const int MR = 6;
+    static const int NV = 2;
+    static const int KC = 256;
+    static const int MC = 120;
+    static const int NC = 2048;
+};
+#endif
+
+#if defined(__AVX512F__) || defined(ALTENSOR_DISPATCH)
+template <>
+struct Config<float, cpu::Isa::AVX512> {
+    typedef Avx512Float Vec;
+    static const int MR = 12;
+    static const int NV = 2;
+    static const int KC = 384;
+    static const int MC = 144;
+    static const int NC = 4096;
+};
+
+template <>
+struct Config<double, cpu::Isa::AVX512> {
+    typedef Avx512Double Vec;
+    static const int MR = 12;
+    static const int NV = 2;
+    static const int KC = 256;
+    static const int MC = 144;
+    static const int NC = 2048;
+};
+#endif
+
+// widest vector type at level L for T, used by the level-2 kernels
+template <typename T, cpu::Isa L>
+struct Simd {
+    typedef ScalarVec<T> Vec;
+};
+
+#if defined(__SSE2__)
+template <cpu::Isa L> struct Simd<float, L> { typedef Sse2Float Vec; };
+template <cpu::Isa L> struct Simd<double, L> { typedef Sse2Double Vec; };
+#endif
+#if defined(__AVX2__) || defined(ALTENSOR_DISPATCH)
+template <> struct Simd<float, cpu::Isa::AVX2> { typedef Avx2Float Vec; };
+template <> struct Simd<double, cpu::Isa::AVX2> { typedef Avx2Double Vec; };
+#endif
+#if defined(__AVX512F__) || defined(ALTENSOR_DISPATCH)
+template <> struct Simd<float, cpu::Isa::AVX512> { typedef Avx512Float Vec; };
+template <> struct Simd<double, cpu::Isa::AVX512> { typedef Avx512Double Vec; };
+#endif
+
+// pack an mc x kc block of A into MR-row slivers, zero padding the last one
+template <typename T, int MR>
+void packA(int mc, int kc, const T* a, long rsa, long csa, T* packed) {
+    for (int i = 0; i < mc; i += MR) {
+        int rows = std::min(MR, mc - i);
+        for (int l = 0; l < kc; l++) {
+            const T* src = a + i * rsa + l * csa;
+            for (int r = 0; r < rows; r++) {
+                packed[r] = src[r * rsa];
+            }
+            for (int r = rows; r < MR; r++) {
+                packed[r] = T(0);
+            }
+            packed += MR;
+        }
+    }
+}
+
+// pack a kc x nc panel of B into NR-column slivers, zero padding the last one
+template <typename T, int NR>
+void packB(int kc, int nc, const T* b, long rsb, long csb, T* packed) {
+    for (int j = 0; j < nc; j += NR) {
+        int cols = std::min(NR, nc - j);
+        for (int l = 0; l < kc; l++) {
+            const T* src = b + l * rsb + j * csb;
+            if (csb == 1) {
+                for (int c = 0; c < cols; c++) {
+                    packed[c] = src[c];
+                }
+            }
+            else {
+                for (int c = 0; c < cols; c++) {
+                    packed[c] = src[c * csb];
+                }
+            }
+            for (int c = cols; c < NR; c++) {
+                packed[c] = T(0);
+            }
+            packed += NR;
+        }
+    }
+}
+
+// C[0:MR, 0:NR] = alpha * (packed A sliver) * (packed B sliver) + beta * C
+// for a full tile of row-contiguous C; partial tiles go through a scratch tile
+template <typename T, typename V, int MR, int NV>
+void microKernel(int kc, const T* a, const T* b, T* c, long rsc, long csc,
+                 int mr, int nr, T alpha, T beta) {
+    const int W = V::width;
+    const int NR = NV * W;
+    typename V::reg acc[MR][NV];
+    for (int i = 0; i < MR; i++) {
+        for (int j = 0; j < NV; j++) {
+            acc[i][j] = V::zero();
+        }
+    }
+    for (int l = 0; l < kc; l++) {
+        typename V::reg bv[NV];
+        for (int j = 0; j < NV; j++) {
+            bv[j] = V::load(b + j * W);
+        }
+        for (int i = 0; i < MR; i++) {
+            typename V::reg av = V::set1(a[i]);
+            for (int j = 0; j < NV; j++) {
+                acc[i][j] = V::fmadd(av, bv[j], acc[i][j]);
+            }
+        }
+        a += MR;
+        b += NR;
+    }
+
+    typename V::reg valpha = V::set1(alpha);
+    if (mr == MR && nr == NR && csc == 1) {
+        if (beta == T(0)) {
+            for (int i = 0; i < MR; i++) {
+                for (int j = 0; j < NV; j++) {
+                    V::store(c + i * rsc + j * W, V::mul(valpha, acc[i][j]));
+                }
+            }
+        }
+        else {
+            typename V::reg vbeta = V::set1(beta);
+            for (int i = 0; i < MR; i++) {
+                for (int j = 0; j < NV; j++) {
+                    T* cp = c + i * rsc + j * W;
+                    V::store(cp, V::fmadd(vbeta, V::load(cp), V::mul(valpha, acc[i][j])));
+                }
+            }
+        }
+        return;
+    }
+
+    T tile[MR * NR];
+    for (int i = 0; i < MR; i++) {
+        for (int j = 0; j < NV; j++) {
+            V::store(tile + i * NR + j * W, acc[i][j]);
+        }
+    }
+    for (int i = 0; i < mr; i++) {
+        for (int j = 0; j < nr; j++) {
+            T* cp = c + i * rsc + j * csc;
+            T v = alpha * tile[i * NR + j];
+            *cp = beta == T(0) ? v : v + beta * *cp;
+        }
+    }
+}
+
+// per-thread packing buffers so repeated calls do not hit the allocator
+template <typename T>
+T* packBuffer(int which, size_t size) {
+    static thread_local std::vector<T> buffers[2];
+    if (buffers[which].size() < size) {
+        buffers[which].resize(size);
+    }
+    return buffers[which].data();
+}
+
+// macro-kernel over one packed mc x kc block of A and kc x nc panel of B
+template <typename T, cpu::Isa L>
+void macroKernel(int mc, int nc, int kc, const T* packedA, const T* packedB,
+                 T* c, long rsc, long csc, T alpha, T beta) {
+    typedef Config<T, L> C;
+    const int NR = C::NV * C::Vec::width;
+    for (int j = 0; j < nc; j += NR) {
+        int nr = std::min(NR, nc - j);
+        for (int i = 0; i < mc; i += C::MR) {
+            int mr = std::min((int)C::MR, mc - i);
+            microKernel<T, typename C::Vec, C::MR, C::NV>(
+                kc, packedA + i * kc, packedB + j * kc,
+                c + i * rsc + j * csc, rsc, csc, mr, nr, alpha, beta);
+        }
+    }
+}
+
+// reference loop for products too small to amortize packing
+template <typename T>
+void gemmSmall(long m, long n, long k, T alpha,
+               const T* a, long rsa, long csa,
+               const T* b, long rsb, long csb,
+               T beta, T* c, long rsc, long csc) {
+    for (long i = 0; i < m; i++) {
+        for (long j = 0; j < n; j++) {
+            T* cp = c + i * rsc + j * csc;
+            *cp = beta == T(0) ? T(0) : beta * *cp;
+        }
+        for (long l = 0; l < k; l++) {
+            T av = alpha * a[i * rsa + l * csa];
+            const T* bp = b + l * rsb;
+            T* cp = c + i * rsc;
+            for (long j = 0; j < n; j++) {
+                cp[j * csc] += av * bp[j * csb];
+            }
+        }
+    }
+}
+
+// single threaded C = alpha * A * B + beta * C
+template <typename T, cpu::Isa L>
+void gemmSerial(long m, long n, long k, T alpha,
+          const T* a, long rsa, long csa,
+          const T* b, long rsb, long csb,
+          T beta, T* c, long rsc, long csc) {
+    typedef Config<T, L> C;
+    const int NR = C::NV * C::Vec::width;
+    if (m == 0 || n == 0) {
+        return;
+    }
+    if (m * n * k < 4096 || k == 0) {
+        gemmSmall(m, n, k, alpha, a, rsa, csa, b, rsb, csb, beta, c, rsc, csc);
+        return;
+    }
+
+    int kcMax = (int)std::min(k, (long)C::KC);
+    int ncMax = (int)std::min(n, (long)C::NC);
+    int mcMax = (int)std::min(m, (long)C::MC);
+    T* packedB = packBuffer<T>(0, (size_t)kcMax * ((ncMax + NR - 1) / NR) * NR);
+    T* packedA = packBuffer<T>(1, (size_t)kcMax * ((mcMax + C::MR - 1) / C::MR) * C::MR);
+
+    for (long jc = 0; jc < n; jc += C::NC) {
+        int nc = (int)std::min((long)C::NC, n - jc);
+        for (long pc = 0; pc < k; pc += C::KC) {
+            int kc = (int)std::min((long)C::KC, k - pc);
+            // only the first rank-kc update scales the existing C
+            T betaBlock = pc == 0 ? beta : T(1);
+            packB<T, NR>(kc, nc, b + pc * rsb + jc * csb, rsb, csb, packedB);
+            for (long ic = 0; ic < m; ic += C::MC) {
+                int mc = (int)std::min((long)C::MC, m - ic);
+                packA<T, C::MR>(mc, kc, a + ic * rsa + pc * csa, rsa, csa, packedA);
+                macroKernel<T, L>(mc, nc, kc, packedA, packedB,
+                            c + ic * rsc + jc * csc, rsc, csc, alpha, betaBlock);
+            }
+        }
+    }
+}
+
+// gemmSerial compiled for level L, called through cpu::Target<L>
+struct SerialKernel {
+    template <cpu::Isa L, typename T>
+    static void run(long m, long n, long k, T alpha,
+                    const T* a, long rsa, long csa,
+                    const T* b, long rsb, long csb,
+                    T beta, T* c, long rsc, long csc) {
+        gemmSerial<T, L>(m, n, k, alpha, a, rsa, csa, b, rsb, csb, beta, c, rsc, csc);
+    }
+};
+
+// below this many multiply-adds a product stays on the calling thread
+const long parallelThreshold = 64L * 64 * 64;
+
+// rows of the reduction handled by one task when splitting over k
+const int kSplitChunk = 8192;
+
+// gemm() with the tiles of level L
+template <typename T, cpu::Isa L>
+void gemmLevel(long m, long n, long k, T alpha,
+               const T* a, long rsa, long csa,
+               const T* b, long rsb, long csb,
+               T beta, T* c, long rsc, long csc) {
+    typedef Config<T, L> C;
+    const int NR = C::NV * C::Vec::width;
+    long tilesM = (m + C::MR - 1) / C::MR;
+    long tilesN = (n + NR - 1) / NR;
+    if (tilesM == 1 && tilesN == 1 && k > kSplitChunk) {
+        int chunks = (int)((k + kSplitChunk - 1) / kSplitChunk);
+        std::vector<T> partial((size_t)chunks * m * n);
+        parallel::parallelFor(chunks, [&](int t) {
+            long k0 = (long)t * kSplitChunk;
+            long kc = std::min((long)kSplitChunk, k - k0);
+            cpu::Target<L>::template call<SerialKernel>(m, n, kc, T(1), a + k0 * csa, rsa, csa,
+                                                        b + k0 * rsb, rsb, csb,
+                                                        T(0), &partial[(size_t)t * m * n], (long)n, 1L);
+        });
+        for (long i = 0; i < m; i++) {
+            for (long j = 0; j < n; j++) {
+                T sum = T(0);
+                for (int t = 0; t < chunks; t++) {
+                    sum += partial[(size_t)t * m * n + i * n + j];
+                }
+                T* cp = c + i * rsc + j * csc;
+                *cp = beta == T(0) ? alpha * sum : alpha * sum + beta * *cp;
+            }
+        }
+        return;
+    }
+
+    int threads = parallel::getNumThreads();
+    if (threads <= 1 || m * n * k < parallelThreshold) {
+        cpu::Target<L>::template call<SerialKernel>(m, n, k, alpha, a, rsa, csa, b, rsb, csb,
+                                                    beta, c, rsc, csc);
+        return;
+    }
+    int mt = (int)std::min((long)threads, tilesM);
+    int nt = (int)std::min((long)std::max(1, threads / mt), tilesN);
+
+    // tile edges are kept on register tile boundaries
+    long rowsPerTile = (tilesM + mt - 1) / mt * C::MR;
+    long colsPerTile = (tilesN + nt - 1) / nt * NR;
+    parallel::parallelFor(mt * nt, [&](int t) {
+        long i0 = (t / nt) * rowsPerTile;
+        long j0 = (t % nt) * colsPerTile;
+        if (i0 >= m || j0 >= n) {
+            return;
+        }
+        long mc = std::min(rowsPerTile, m - i0);
+        long nc = std::min(colsPerTile, n - j0);
+        cpu::Target<L>::template call<SerialKernel>(mc, nc, k, alpha, a + i0 * rsa, rsa, csa,
+                                                    b + j0 * csb, rsb, csb,
+                                                    beta, c + i0 * rsc + j0 * csc, rsc, csc);
+    });
+}
+
+struct GemmKernel {
+    template <cpu::Isa L, typename T>
+    static void run(long m, long n, long k, T alpha,
+                    const T* a, long rsa, long csa,
+                    const T* b, long rsb, long csb,
+                    T beta, T* c, long rsc, long csc) {
+        gemmLevel<T, L>(m, n, k, alpha, a, rsa, csa, b, rsb, csb, beta, c, rsc, csc);
+    }
+};
+
+// C = alpha * A * B + beta * C for arbitrary row/column strides.
+// Large products are cut into a grid of C tiles that run on the thread pool;
+// products whose C is a single register tile (X^T * r in training) split the
+// k dimension instead and sum the partial tiles in a fixed order, so the
+// result does not depend on the thread count.
+template <typename T>
+void gemm(long m, long n, long k, T alpha,
+          const T* a, long rsa, long csa,
+          const T* b, long rsb, long csb,
+          T beta, T* c, long rsc, long csc) {
+    cpu::dispatch<GemmKernel>(m, n, k, alpha, a, rsa, csa, b, rsb, csb, beta, c, rsc, csc);
+}
+
+// dot product of two contiguous vectors with four independent accumulators
+template <typename T, cpu::Isa L>
+T dotKernel(long n, const T* a, const T* x) {
+    typedef typename Simd<T, L>::Vec V;
+    const int W = V::width;
+    typename V::reg s0 = V::zero(), s1 = V::zero(), s2 = V::zero(), s3 = V::zero();
+    long i = 0;
+    for (; i + 4 * W <= n; i += 4 * W) {
+        s0 = V::fmadd(V::load(a + i), V::load(x + i), s0);
+        s1 = V::fmadd(V::load(a + i + W), V::load(x + i + W), s1);
+        s2 = V::fmadd(V::load(a + i + 2 * W), V::load(x + i + 2 * W), s2);
+        s3 = V::fmadd(V::load(a + i + 3 * W), V::load(x + i + 3 * W), s3);
+    }
+    for (; i + W <= n; i += W) {
+        s0 = V::fmadd(V::load(a + i), V::load(x + i), s0);
+    }
+    T sum = V::hsum(V::add(V::add(s0, s1), V::add(s2, s3)));
+    for (; i < n; i++) {
+        sum += a[i] * x[i];
+    }
+    return sum;
+}
+
+// out[0:4] = dot products of four contiguous rows, lda apart, with x
+template <typename T, cpu::Isa L>
+void dot4Kernel(long n, const T* a, long lda, const T* x, T* out) {
+    typedef typename Simd<T, L>::Vec V;
+    const int W = V::width;
+    const T* a0 = a;
+    const T* a1 = a + lda;
+    const T* a2 = a + 2 * lda;
+    const T* a3 = a + 3 * lda;
+    typename V::reg s0 = V::zero(), s1 = V::zero(), s2 = V::zero(), s3 = V::zero();
+    long i = 0;
+    for (; i + W <= n; i += W) {
+        typename V::reg xv = V::load(x + i);
+        s0 = V::fmadd(V::load(a0 + i), xv, s0);
+        s1 = V::fmadd(V::load(a1 + i), xv, s1);
+        s2 = V::fmadd(V::load(a2 + i), xv, s2);
+        s3 = V::fmadd(V::load(a3 + i), xv, s3);
+    }
+    T r0 = V::hsum(s0), r1 = V::hsum(s1), r2 = V::hsum(s2), r3 = V::hsum(s3);
+    for (; i < n; i++) {
+        r0 += a0[i] * x[i];
+        r1 += a1[i] * x[i];
+        r2 += a2[i] * x[i];
+        r3 += a3[i] * x[i];
+    }
+    out[0] = r0;
+    out[1] = r1;
+    out[2] = r2;
+    out[3] = r3;
+}
+
+// y[0:n] += alpha * x[0:n] for contiguous vectors
+template <typename T, cpu::Isa L>
+void axpyKernel(long n, T alpha, const T* x, T* y) {
+    typedef typename Simd<T, L>::Vec V;
+    const int W = V::width;
+    typename V::reg va = V::set1(alpha);
+    long i = 0;
+    for (; i + 2 * W <= n; i += 2 * W) {
+        V::store(y + i, V::fmadd(va, V::load(x + i), V::load(y + i)));
+        V::store(y + i + W, V::fmadd(va, V::load(x + i + W), V::load(y + i + W)));
+    }
+    for (; i + W <= n; i += W) {
+        V::store(y + i, V::fmadd(va, V::load(x + i), V::load(y + i)));
+    }
+    for (; i < n; i++) {
+        y[i] += alpha * x[i];
+    }
+}
+
+// out[0:m] = A[0:m, 0:n] * x for one block of rows and columns, without
+// alpha/beta. Row-contiguous A takes one dot product per row, column
+// contiguous A (a transposed row-major matrix, X^T in training) takes one
+// axpy per column so it is still read in storage order.
+template <typename T, cpu::Isa L>
+void gemvBlock(long m, long n, const T* a, long rsa, long csa,
+               const T* x, long incx, T* out) {
+    if (csa == 1 && incx == 1) {
+        long i = 0;
+        if (n < 64) {
+            // short rows: four rows at a time share the loads of x
+            for (; i + 4 <= m; i += 4) {
+                dot4Kernel<T, L>(n, a + i * rsa, rsa, x, out + i);
+            }
+        }
+        for (; i < m; i++) {
+            out[i] = dotKernel<T, L>(n, a + i * rsa, x);
+        }
+        return;
+    }
+    for (long i = 0; i < m; i++) {
+        out[i] = T(0);
+    }
+    if (rsa == 1) {
+        for (long j = 0; j < n; j++) {
+            axpyKernel<T, L>(m, x[j * incx], a + j * csa, out);
+        }
+        return;
+    }
+    for (long i = 0; i < m; i++) {
+        T sum = T(0);
+        for (long j = 0; j < n; j++) {
+            sum += a[i * rsa + j * csa] * x[j * incx];
+        }
+        out[i] = sum;
+    }
+}
+
+struct GemvBlockKernel {
+    template <cpu::Isa L, typename T>
+    static void run(long m, long n, const T* a, long rsa, long csa,
+                    const T* x, long incx, T* out) {
+        gemvBlock<T, L>(m, n, a, rsa, csa, x, incx, out);
+    }
+};
+
+// columns of A reduced by one task, fixed so results do not depend on the
+// thread count
+const int gemvChunk = 16384;
+
+// y = alpha * A * x + beta * y with A m x n. Memory bound, so the work is cut
+// into row blocks and column chunks that each stream a contiguous part of A;
+// chunks write private partial sums that are added in chunk order.
+template <typename T>
+void gemv(long m, long n, T alpha, const T* a, long rsa, long csa,
+          const T* x, long incx, T beta, T* y, long incy) {
+    if (m == 0) {
+        return;
+    }
+    int chunks = n > gemvChunk ? (int)((n + gemvChunk - 1) / gemvChunk) : 1;
+    long cols = chunks == 1 ? n : gemvChunk;
+    long rowsPerBlock = std::max(16L, 65536 / std::max(1L, cols));
+    int blocks = (int)((m + rowsPerBlock - 1) / rowsPerBlock);
+
+    // a single chunk writes straight into a contiguous y when beta is 0
+    bool direct = chunks == 1 && incy == 1 && beta == T(0);
+    std::vector<T> partial(direct ? 0 : (size_t)chunks * m);
+    T* out = direct ? y : partial.data();
+    std::function<void(int)> task = [&](int t) {
+        long i0 = (t / chunks) * rowsPerBlock;
+        long j0 = (long)(t % chunks) * gemvChunk;
+        long mb = std::min(rowsPerBlock, m - i0);
+        long nb = std::min(cols, n - j0);
+        cpu::dispatch<GemvBlockKernel>(mb, nb, a + i0 * rsa + j0 * csa, rsa, csa, x + j0 * incx, incx,
+                                       out + (size_t)(t % chunks) * m + i0);
+    };
+    if (m * n < parallelThreshold) {
+        for (int t = 0; t < blocks * chunks; t++) {
+            task(t);
+        }
+    }
+    else {
+        parallel::parallelFor(blocks * chunks, task);
+    }
+
+    if (direct) {
+        if (alpha != T(1)) {
+            for (long i = 0; i < m; i++) {
+                y[i] *= alpha;
+            }
+        }
+        return;
+    }
+    for (long i = 0; i < m; i++) {
+        T sum = partial[i];
+        for (int t = 1; t < chunks; t++) {
+            sum += partial[(size_t)t * m + i];
+        }
+        T* yp = y + i * incy;
+        *yp = beta == T(0) ? alpha * sum : alpha * sum + beta * *yp;
+    }
+}
+
+// f(i0, rows) of gemvForwardBackward as a number: its return value, or 0
+// when it returns nothing
+template <typename T, typename F>
+typename std::enable_if<std::is_void<typename std::result_of<const F&(long, long)>::type>::value, T>::type
+blockValue(const F& f, long i0, long rows) {
+    f(i0, rows);
+    return T(0);
+}
+
+template <typename T, typename F>
+typename std::enable_if<!std::is_void<typename std::result_of<const F&(long, long)>::type>::value, T>::type
+blockValue(const F& f, long i0, long rows) {
+    return T(f(i0, rows));
+}
+
+// Forward and backward product of a linear model in one sweep over A:
+// r = A * x one block of rows at a time, f(i0, rows) then turns r[i0, i0 + rows)
+// into the residual in place, and g = A^T * r is accumulated while the block
+// is still in cache. f may be called concurrently for different blocks.
+// If sums is given it receives the sum of r and the sum of its squares, and
+// when f returns a value (a per-block loss, say) the total over all blocks in
+// sums[2]. Blocks depend only on the shape and their partial results are
+// combined by a pairwise tree in block order, so the result does not depend
+// on the thread count.
+template <typename T, typename F>
+void gemvForwardBackward(long m, long n, const T* a, long rsa, long csa,
+                         const T* x, long incx, T* r, const F& f, T* g, T* sums = nullptr) {
+    long rowsPerBlock = std::max(16L, 65536 / std::max(1L, n));
+    int blocks = (int)std::max(1L, (m + rowsPerBlock - 1) / rowsPerBlock);
+    // per block: n gradient entries, then sum(r), sum(r^2) and f's value
+    long width = n + 3;
+    std::vector<T> partial((size_t)blocks * width, T(0));
+    std::function<void(int)> task = [&](int t) {
+        long i0 = t * rowsPerBlock;
+        long mb = std::min(rowsPerBlock, m - i0);
+        if (mb <= 0) {
+            return;
+        }
+        const T* block = a + i0 * rsa;
+        T* out = partial.data() + (size_t)t * width;
+        cpu::dispatch<GemvBlockKernel>(mb, n, block, rsa, csa, x, incx, r + i0);
+        out[n + 2] = blockValue<T>(f, i0, mb);
+        cpu::dispatch<GemvBlockKernel>(n, mb, block, csa, rsa, r + i0, 1L, out);
+        T sum = T(0);
+        T squares = T(0);
+        for (long i = i0; i < i0 + mb; i++) {
+            sum += r[i];
+            squares += r[i] * r[i];
+        }
+        out[n] = sum;
+        out[n + 1] = squares;
+    };
+    if ((long)m * n < parallelThreshold) {
+        for (int t = 0; t < blocks; t++) {
+            task(t);
+        }
+    }
+    else {
+        parallel::parallelFor(blocks, task);
+    }
+
+    for (int step = 1; step < blocks; step *= 2) {
+        for (int t = 0; t + step < blocks; t += 2 * step) {
+            T* dst = partial.data() + (size_t)t * width;
+            const T* src = partial.data() + (size_t)(t + step) * width;
+            for (long j = 0; j < width; j++) {
+                dst[j] += src[j];
+            }
+        }
+    }
+    std::copy(partial.begin(), partial.begin() + n, g);
+    if (sums != nullptr) {
+        sums[0] = partial[n];
+        sums[1] = partial[n + 1];
+        if (!std::is_void<typename std::result_of<const F&(long, long)>::type>::value) {
+            sums[2] = partial[n + 2];
+        }
+    }
+}
+
+} // namespace gemm
+
+#if defined(ALTENSOR_DISPATCH)
+#pragma GCC diagnostic pop
+#endif
+
+#endif
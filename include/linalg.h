@@ -0,0 +1,321 @@
+#ifndef LINALG_H
+#define LINALG_H
+
+#include <vector>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <algorithm>
+#include <functional>
+
+#include <gemm.h>
+#include <parallel.h>
+
+// Dense solvers for linear least squares.
+//
+// The normal-equation path forms the Gram matrix of the design in one pass
+// over the data (gramWithIntercept) and solves the small symmetric system
+// with a blocked Cholesky factorization. When that system is too badly
+// conditioned for Cholesky to be accurate, the caller falls back to a
+// column-pivoted Householder QR of the design itself (qrLeastSquares), which
+// works with cond(X) instead of cond(X)^2.
+//
+// Matrices are row-major with a leading dimension unless stated otherwise.
+namespace linalg {
+
+// out = [X 1 y]^T W [X 1 y], a (d + 2) x (d + 2) row-major matrix, for X m x d,
+// y of length m and W the diagonal of the weights (all ones when weights is
+// null). Its leading (d + 1) x (d + 1) block and the first d + 1 entries of
+// its last column are the normal equations of a (weighted) fit with an
+// intercept, the last entry is y^T W y. Each block of rows is read from
+// memory once: X^T X of the block by gemm, then the intercept and y columns
+// from cache. With weights the rows are scaled by sqrt(w) into a small
+// buffer first. Blocks depend only on the shape and are combined by a
+// pairwise tree, so the result does not depend on the thread count.
+template <typename T>
+void gramWithIntercept(long m, int d, const T* x, long rsx, long csx,
+                       const T* y, long incy, T* out,
+                       const T* weights = nullptr, long incw = 1) {
+    const int maxBlocks = 64;
+    int w = d + 2;
+    long rowsPerBlock = std::max(256, 65536 / std::max(1, d));
+    int blocks = (int)std::max(1L, (m + rowsPerBlock - 1) / rowsPerBlock);
+    if (blocks > maxBlocks) {
+        blocks = maxBlocks;
+        rowsPerBlock = (m + blocks - 1) / blocks;
+    }
+    std::vector<T> partial((size_t)blocks * w * w, T(0));
+    std::function<void(int)> task = [&](int t) {
+        long i0 = t * rowsPerBlock;
+        long mb = std::min(rowsPerBlock, m - i0);
+        if (mb <= 0) {
+            return;
+        }
+        const T* xb = x + i0 * rsx;
+        T* p = partial.data() + (size_t)t * w * w;
+        std::vector<T> scaled;
+        if (weights == nullptr) {
+            if (d > 0) {
+                gemm::gemm<T>(d, d, mb, T(1), xb, csx, rsx, xb, rsx, csx, T(0), p, w, 1);
+            }
+        }
+        else if (d > 0) {
+            // sqrt(w) X one chunk of rows at a time, accumulated into p
+            long chunk = std::max(256, 65536 / d);
+            scaled.resize((size_t)std::min(chunk, mb) * d);
+            for (long c0 = 0; c0 < mb; c0 += chunk) {
+                long cb = std::min(chunk, mb - c0);
+                for (long i = 0; i < cb; i++) {
+                    const T* row = xb + (c0 + i) * rsx;
+                    T scale = std::sqrt(weights[(i0 + c0 + i) * incw]);
+                    for (int j = 0; j < d; j++) {
+                        scaled[(size_t)i * d + j] = scale * row[j * csx];
+                    }
+                }
+                gemm::gemm<T>(d, d, cb, T(1), scaled.data(), 1, d, scaled.data(), d, 1,
+                              c0 == 0 ? T(0) : T(1), p, w, 1);
+            }
+        }
+        // column sums and X^T y of the block, accumulated contiguously
+        std::vector<T> sums(2 * (size_t)d, T(0));
+        T* ones = sums.data();
+        T* xy = sums.data() + d;
+        T total = T(0);
+        T ysum = T(0);
+        T yy = T(0);
+        for (long i = 0; i < mb; i++) {
+            const T* row = xb + i * rsx;
+            T wi = weights == nullptr ? T(1) : weights[(i0 + i) * incw];
+            T yi = y[(i0 + i) * incy];
+            T wy = wi * yi;
+            for (int j = 0; j < d; j++) {
+                T v = row[j * csx];
+                ones[j] += wi * v;
+                xy[j] += v * wy;
+            }
+            total += wi;
+            ysum += wy;
+            yy += wy * yi;
+        }
+        for (int j = 0; j < d; j++) {
+            p[j * w + d] = p[d * w + j] = ones[j];
+            p[j * w + d + 1] = p[(d + 1) * w + j] = xy[j];
+        }
+        p[d * w + d] = total;
+        p[d * w + d + 1] = p[(d + 1) * w + d] = ysum;
+        p[(d + 1) * w + d + 1] = yy;
+    };
+    if (m * w < gemm::parallelThreshold) {
+        for (int t = 0; t < blocks; t++) {
+            task(t);
+        }
+    }
+    else {
+        parallel::parallelFor(blocks, task);
+    }
+
+    for (int step = 1; step < blocks; step *= 2) {
+        for (int t = 0; t + step < blocks; t += 2 * step) {
+            T* dst = partial.data() + (size_t)t * w * w;
+            const T* src = partial.data() + (size_t)(t + step) * w * w;
+            for (int j = 0; j < w * w; j++) {
+                dst[j] += src[j];
+            }
+        }
+    }
+    std::copy(partial.begin(), partial.begin() + w * w, out);
+}
+
+// In-place Cholesky factorization A = L L^T of a symmetric positive definite
+// n x n matrix. Only the lower triangle is read and L overwrites it, the upper
+// triangle is left as scratch. Right-looking and blocked: each diagonal block
+// and the panel under it are factored directly, the trailing matrix is
+// updated with one gemm. Returns false if A is not numerically positive
+// definite.
+template <typename T>
+bool cholesky(int n, T* a, int lda) {
+    const int nb = 64;
+    for (int k0 = 0; k0 < n; k0 += nb) {
+        int kb = std::min(nb, n - k0);
+        for (int j = k0; j < k0 + kb; j++) {
+            T diag = a[j * lda + j];
+            for (int p = k0; p < j; p++) {
+                diag -= a[j * lda + p] * a[j * lda + p];
+            }
+            if (!(diag > T(0))) {
+                return false;
+            }
+            diag = std::sqrt(diag);
+            a[j * lda + j] = diag;
+            // the rest of column j, in the diagonal block and in the panel
+            for (int i = j + 1; i < n; i++) {
+                T s = a[i * lda + j];
+                for (int p = k0; p < j; p++) {
+                    s -= a[i * lda + p] * a[j * lda + p];
+                }
+                a[i * lda + j] = s / diag;
+            }
+        }
+        int rest = n - k0 - kb;
+        if (rest > 0) {
+            const T* panel = a + (k0 + kb) * lda + k0;
+            gemm::gemm<T>(rest, rest, kb, T(-1), panel, lda, 1, panel, 1, lda,
+                          T(1), a + (k0 + kb) * lda + k0 + kb, lda, 1);
+        }
+    }
+    return true;
+}
+
+// solve L L^T x = b in place with the factor from cholesky()
+template <typename T>
+void choleskySolve(int n, const T* l, int lda, T* b) {
+    for (int i = 0; i < n; i++) {
+        T s = b[i];
+        for (int p = 0; p < i; p++) {
+            s -= l[i * lda + p] * b[p];
+        }
+        b[i] = s / l[i * lda + i];
+    }
+    for (int i = n - 1; i >= 0; i--) {
+        T s = b[i];
+        for (int p = i + 1; p < n; p++) {
+            s -= l[p * lda + i] * b[p];
+        }
+        b[i] = s / l[i * lda + i];
+    }
+}
+
+// Solve the symmetric positive definite system A x = b (A n x n, b
+// overwritten by x) by Cholesky after scaling A to a unit diagonal. Returns
+// false, leaving b undefined, if A is not positive definite or its estimated
+// condition number is above 1 / sqrt(epsilon), where normal equations lose
+// too much accuracy.
+template <typename T>
+bool solveSPD(int n, std::vector<T> a, T* b) {
+    std::vector<T> scale(n);
+    for (int i = 0; i < n; i++) {
+        T diag = a[i * n + i];
+        if (!(diag > T(0))) {
+            return false;
+        }
+        scale[i] = T(1) / std::sqrt(diag);
+    }
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j <= i; j++) {
+            a[i * n + j] *= scale[i] * scale[j];
+        }
+        b[i] *= scale[i];
+    }
+    if (!cholesky(n, a.data(), n)) {
+        return false;
+    }
+    T lo = a[0];
+    T hi = a[0];
+    for (int i = 1; i < n; i++) {
+        lo = std::min(lo, a[i * n + i]);
+        hi = std::max(hi, a[i * n + i]);
+    }
+    T ratio = lo / hi;
+    if (ratio * ratio < std::sqrt(std::numeric_limits<T>::epsilon())) {
+        return false;
+    }
+    choleskySolve(n, a.data(), n, b);
+    for (int i = 0; i < n; i++) {
+        b[i] *= scale[i];
+    }
+    return true;
+}
+
+// Least-squares solution of min |A x - b| for a column-major m x n matrix A
+// (each column contiguous), by Householder QR with column pivoting. A and b
+// are overwritten. Columns that are numerically dependent on the ones
+// before them get a zero coefficient. Returns the numerical rank.
+template <typename T>
+int qrLeastSquares(long m, int n, T* a, T* b, T* x) {
+    std::vector<int> perm(n);
+    std::iota(perm.begin(), perm.end(), 0);
+    std::vector<T> v(m);
+    int steps = (int)std::min(m, (long)n);
+    int rank = steps;
+    T first = T(0);
+    T tol = T(0);
+    for (int k = 0; k < steps; k++) {
+        // pivot on the column with the largest remaining norm
+        int pivot = k;
+        T best = T(-1);
+        for (int j = k; j < n; j++) {
+            const T* col = a + j * m;
+            T norm = T(0);
+            for (long i = k; i < m; i++) {
+                norm += col[i] * col[i];
+            }
+            if (norm > best) {
+                best = norm;
+                pivot = j;
+            }
+        }
+        if (pivot != k) {
+            std::swap_ranges(a + k * m, a + (k + 1) * m, a + pivot * m);
+            std::swap(perm[k], perm[pivot]);
+        }
+        T* col = a + k * m;
+        T alpha = std::sqrt(best);
+        if (k == 0) {
+            first = alpha;
+            tol = std::max(m, (long)n) * std::numeric_limits<T>::epsilon() * first;
+        }
+        if (!(alpha > tol)) {
+            rank = k;
+            break;
+        }
+        if (col[k] > T(0)) {
+            alpha = -alpha;
+        }
+        // reflector v = a[k:, k] - alpha e_k maps the column onto alpha e_k
+        T vnorm = T(0);
+        for (long i = k; i < m; i++) {
+            v[i] = col[i];
+        }
+        v[k] -= alpha;
+        for (long i = k; i < m; i++) {
+            vnorm += v[i] * v[i];
+        }
+        col[k] = alpha;
+        for (int j = k + 1; j < n; j++) {
+            T* cj = a + j * m;
+            T s = T(0);
+            for (long i = k; i < m; i++) {
+                s += v[i] * cj[i];
+            }
+            s = 2 * s / vnorm;
+            for (long i = k; i < m; i++) {
+                cj[i] -= s * v[i];
+            }
+        }
+        T s = T(0);
+        for (long i = k; i < m; i++) {
+            s += v[i] * b[i];
+        }
+        s = 2 * s / vnorm;
+        for (long i = k; i < m; i++) {
+            b[i] -= s * v[i];
+        }
+    }
+    // back substitution on the leading rank x rank block of R
+    std::vector<T> z(n, T(0));
+    for (int i = rank - 1; i >= 0; i--) {
+        T s = b[i];
+        for (int j = i + 1; j < rank; j++) {
+            s -= a[j * m + i] * z[j];
+        }
+        z[i] = s / a[i * m + i];
+    }
+    for (int j = 0; j < n; j++) {
+        x[perm[j]] = z[j];
+    }
+    return rank;
+}
+
+} // namespace linalg
+
+#endif
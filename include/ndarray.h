@@ -5,84 +5,195 @@
 #include <sstream>
 #include <random>
 #include <iostream>
+#include <memory>
+#include <algorithm>
+#include <stdexcept>
+#include <type_traits>
+
+#include <fstream>
+#include <string>
+
+#include <alloc.h>
+#include <dims.h>
+#include <npy.h>
+#include <gemm.h>
+#include <linalg.h>
+#include <expr.h>
+#include <reduce.h>
+
+namespace dataset {
+template <typename T>
+class Stream;
+}
 
+// N-dimensional array.
+//
+// The elements live in storage shared between an array and its views: row
+// indexing, slice(), transpose() and expandDims() return a view onto the same
+// storage with its own offset and strides instead of copying, and writes
+// through a view change the array.
+//
+// Copies (copy constructor or assignment from an lvalue) behave as
+// independent arrays but share the elements until one of them is written:
+// the writer, along with its views, then moves to its own copy of the
+// buffer (copy-on-write). Copying a whole array is therefore cheap, so it
+// can be passed and stored by value; copying a view that covers only part
+// of its buffer, or not in order, copies the elements it sees right away.
+// Assigning an array to a view is such a copy too: it rebinds the view
+// rather than writing through it (see operator=).
+//
+// Storage comes from the calling thread's allocator (see alloc.h), so a
+// training loop can run under an alloc::Arena and reuse its buffers.
+//
+// Shapes, strides, sizes and flat indices are long, so an array may hold more
+// than 2^31 elements (a mapped .npy file, say); axes and ranks stay int.
 template <typename T>
 class NDArray {
     public:
         NDArray() = default;
-        NDArray(std::vector<int> shape);
-        NDArray(std::vector<int> shape, std::vector<T> data);
+        NDArray(dims::Dims shape);
+        NDArray(dims::Dims shape, std::vector<T> data);
+        NDArray(const NDArray<T>& other);
+        // moving keeps the storage, so views stay views when returned
+        NDArray(NDArray<T>&& other);
         ~NDArray();
-        const T& operator[](const std::vector<int> index) const;
-        NDArray<T> operator[](int index) const;
-        T operator[](int index);
+        const T& operator[](const std::vector<long> index) const;
+        // element at (i, j, ...), one integer index per axis: the strides'
+        // dot product with the indices, nothing is allocated
+        template <typename... I>
+        typename std::enable_if<dims::Indices<I...>::value, const T&>::type at(I... index) const;
+        // view of the index-th sub-array along the first axis
+        NDArray<T> operator[](long index) const;
+        T operator[](long index);
         // print the array
         friend std::ostream& operator<<(std::ostream& os, const NDArray<T>& arr) {
             os << arr.str(0);
             return os;
         }
 
-        // equals
-        NDArray<T>& operator=(const NDArray<T>& other);
-
-        // set a value
-        void set(const std::vector<int> index, T value);
-
-        // add two arrays
-        NDArray<T> operator+(const NDArray<T>& arr);
+        // evaluate an element-wise expression (see expr.h) in one pass
+        template <typename E>
+        NDArray(const expr::Expr<E>& e);
 
-        // add a scalar
-        NDArray<T> operator+(const T scalar);
-
-        // subtract a scaler
-        NDArray<T> operator-(const T scalar);
-
-        // subtract two arrays
-        NDArray<T> operator-(const NDArray<T>& arr);
+        // make this array a copy of other, sharing its elements until one of
+        // them is written. On a view this rebinds the view: row = z leaves
+        // the array row was taken from unchanged, while row += z writes into
+        // it. To write z's values through the view, assign an expression,
+        // row = expr::Leaf<T>(z).
+        NDArray<T>& operator=(const NDArray<T>& other);
+        NDArray<T>& operator=(NDArray<T>&& other);
 
-        NDArray<T> operator-= (const NDArray<T>& arr);
+        // evaluate an expression straight into this array (through a view,
+        // the viewed elements are written)
+        template <typename E>
+        NDArray<T>& operator=(const expr::Expr<E>& e);
 
-        NDArray<T> operator-= (const T scalar);
+        // set a value
+        void set(const std::vector<long> index, T value);
+        // set(i, j, ..., value): the same without building an index vector;
+        // only taken for integer indices and a value convertible to T
+        template <typename... A>
+        typename std::enable_if<dims::IndicesThenValue<T, A...>::value>::type set(A... args);
+
+        // give this array and its views a buffer that no copy shares,
+        // copying it if needed. Every write does this itself; call it
+        // first when several threads are about to write at once.
+        void unshare();
+
+        // +, -, * and / between arrays, expressions and scalars are the lazy
+        // operators from expr.h, broadcasting like NumPy
+
+        // in-place arithmetic, written into the existing storage without
+        // allocating (through a view, the viewed elements are updated); the
+        // operand is broadcast to this array's shape
+        NDArray<T>& operator+= (const NDArray<T>& arr);
+        NDArray<T>& operator-= (const NDArray<T>& arr);
+        NDArray<T>& operator*= (const NDArray<T>& arr);
+        NDArray<T>& operator/= (const NDArray<T>& arr);
+
+        NDArray<T>& operator+= (const T scalar);
+        NDArray<T>& operator-= (const T scalar);
+        NDArray<T>& operator*= (const T scalar);
+        NDArray<T>& operator/= (const T scalar);
+
+        template <typename E>
+        NDArray<T>& operator+= (const expr::Expr<E>& e);
+        template <typename E>
+        NDArray<T>& operator-= (const expr::Expr<E>& e);
+        template <typename E>
+        NDArray<T>& operator*= (const expr::Expr<E>& e);
+        template <typename E>
+        NDArray<T>& operator/= (const expr::Expr<E>& e);
+
+        // this += alpha * x
+        NDArray<T>& axpy(T alpha, const NDArray<T>& x);
+
+        // in-place versions of the element-wise functions
+        NDArray<T>& expInPlace();
+        NDArray<T>& absInPlace();
+        NDArray<T>& invInPlace();
+        NDArray<T>& powInPlace(int power);
 
         bool operator== (const NDArray<T>& arr);
 
-        // multiply two arrays
-        NDArray<T> operator*(const NDArray<T>& arr);
-
-        // multiply scalar
-        NDArray<T> operator*(T scalar);
-
         // tensor product of two arrays
-        NDArray<T> matMult(const NDArray<T>& arr);
-
-        // divide two arrays
-        NDArray<T> operator/(const NDArray<T>& arr);
-
-        // divide a scalar to an array
-        NDArray<T> operator/(T scalar);
+        NDArray<T> matMult(const NDArray<T>& arr) const;
+
+        // op(this) * op(arr) where op transposes its operand when the flag is
+        // set, read straight from the untransposed storage
+        NDArray<T> matMult(const NDArray<T>& arr, bool transA, bool transB) const;
+
+        // forward and backward pass of a linear model reading this matrix
+        // once: r = this * v is built one block of rows at a time and handed
+        // to f(block, start), a view of r from row `start` that f turns into
+        // the residual in place; returns this^T * r. f may run concurrently
+        // on different blocks. If sums is given it receives the sum of r and
+        // the sum of its squares, and if f returns a value, the total of
+        // those values in sums[2].
+        template <typename F>
+        NDArray<T> forwardBackward(const NDArray<T>& v, NDArray<T>& r, F f, T* sums = nullptr) const;
+
+        // [X 1 y]^T [X 1 y] for this m x d matrix X and a column y, in one
+        // pass over the rows: the normal equations of a least-squares fit
+        // with an intercept, plus y^T y in the last entry
+        NDArray<T> gramWithIntercept(const NDArray<T>& y) const;
+        // the same with row i weighted by weights[i] >= 0, [X 1 y]^T W [X 1 y]
+        NDArray<T> gramWithIntercept(const NDArray<T>& y, const NDArray<T>& weights) const;
 
         // tensor product of two arrays
         NDArray<T> tensProd(const NDArray<T>& arr);
 
-        // expand the array by one dimension
+        // expand the array by one dimension, as a view
         NDArray<T> expandDims(int axis);
 
-        int size();
-        int size(int dim);
-        int rank();
-        std::vector<int> shape();
-        std::vector<int> strides();
-        void reshape(std::vector<int> shape);
-        void resize(std::vector<int> shape);
+        // view of [start, stop) with the given step along one axis
+        NDArray<T> slice(int axis, long start, long stop, long step = 1) const;
+
+        // copy rows indices[start], indices[start + 1], ... of src (along the
+        // first axis) into the rows of this array, in place
+        void gatherRows(const NDArray<T>& src, const std::vector<long>& indices, long start);
+
+        // true if the elements are laid out densely in row-major order
+        bool isContiguous() const;
+
+        long size() const;
+        long size(int dim) const;
+        int rank() const;
+        const dims::Dims& shape() const;
+        const dims::Dims& strides() const;
+        void reshape(dims::Dims shape);
+        void resize(dims::Dims shape);
+        void resize(long size);
+        // an int size would be as close to resize(bool) as to resize(long)
         void resize(int size);
-        void resize(int size, int dim);
-        void resize(int size, int dim, T value);
-        void resize(int size, int dim, T value, bool copy);
-        void resize(int size, int dim, bool copy);
-        void resize(int size, bool copy);
-        void resize(std::vector<int> shape, T value);
-        void resize(std::vector<int> shape, T value, bool copy);
-        void resize(std::vector<int> shape, bool copy);
+        void resize(long size, int dim);
+        void resize(long size, int dim, T value);
+        void resize(long size, int dim, T value, bool copy);
+        void resize(long size, int dim, bool copy);
+        void resize(long size, bool copy);
+        void resize(dims::Dims shape, T value);
+        void resize(dims::Dims shape, T value, bool copy);
+        void resize(dims::Dims shape, bool copy);
         void resize(bool copy);
         void fill(T value);
         void fill(T value, bool copy);
@@ -93,35 +204,149 @@ class NDArray {
         std::string str(int index) const;
         void random();
         void random(T min, T max);
+        // transposes are views with the strides swapped
         NDArray<T> transpose();
         NDArray<T> transpose(int dim1, int dim2);
 
         NDArray<T> flatten();
         std::vector<T> toVector();
-        NDArray<T> round();
-        NDArray<T> abs();
-        NDArray<T> exp();
-        NDArray<T> pow(int power);
-        NDArray<T> sum(int axis);
-        NDArray<T> inv();
-        NDArray<T> eq(NDArray<T> &y);
 
-        T dot(NDArray<T> &other);
-        T sum();
+        // write the array to `path` as a .npy file (see npy.h)
+        void save(const std::string& path) const;
+        // read a .npy file of T elements; a mapped array is backed by the
+        // file's pages and keeps them mapped while it or a view is alive
+        static NDArray<T> load(const std::string& path, npy::Mode mode = npy::Mode::CopyOnWrite);
+        // lazy element-wise functions, evaluated on assignment
+        expr::Unary<expr::Round, expr::Leaf<T> > round() const;
+        expr::Unary<expr::Abs, expr::Leaf<T> > abs() const;
+        expr::Unary<expr::Exp, expr::Leaf<T> > exp() const;
+        expr::Unary<expr::Log, expr::Leaf<T> > log() const;
+        expr::Unary<expr::Log1p, expr::Leaf<T> > log1p() const;
+        expr::Unary<expr::Tanh, expr::Leaf<T> > tanh() const;
+        // 1 / (1 + e^-x) and its log, without overflow for any x
+        expr::Unary<expr::Sigmoid, expr::Leaf<T> > sigmoid() const;
+        expr::Unary<expr::LogSigmoid, expr::Leaf<T> > logSigmoid() const;
+        expr::Unary<expr::Sqrt, expr::Leaf<T> > sqrt() const;
+        expr::Unary<expr::Pow, expr::Leaf<T> > pow(int power) const;
+        expr::Unary<expr::Inv, expr::Leaf<T> > inv() const;
+        expr::Binary<expr::Eq, expr::Leaf<T>, expr::Leaf<T> > eq(const NDArray<T> &y) const;
+
+        // sums are blocked pairwise unless mode is Summation::Compensated,
+        // and do not depend on the thread count (see reduce.h)
+        T dot(NDArray<T> &other, reduce::Summation mode = reduce::Summation::Pairwise);
+        T sum(reduce::Summation mode = reduce::Summation::Pairwise);
+
+        // Reductions over one axis or several, negative axes counting from
+        // the end. The reduced axes are dropped from the result's shape, or
+        // kept with length 1 if keepdims is set so that the result broadcasts
+        // against this array. Reducing every axis without keepdims gives
+        // shape {1}. Only the result is allocated.
+        NDArray<T> sum(int axis, bool keepdims = false) const;
+        NDArray<T> sum(const std::vector<int>& axes, bool keepdims = false) const;
+        NDArray<T> mean(int axis, bool keepdims = false) const;
+        NDArray<T> mean(const std::vector<int>& axes, bool keepdims = false) const;
+        NDArray<T> min(int axis, bool keepdims = false) const;
+        NDArray<T> min(const std::vector<int>& axes, bool keepdims = false) const;
+        NDArray<T> max(int axis, bool keepdims = false) const;
+        NDArray<T> max(const std::vector<int>& axes, bool keepdims = false) const;
+        // variance about the mean, divided by the count minus ddof (two passes)
+        NDArray<T> var(int axis, bool keepdims = false, int ddof = 0) const;
+        NDArray<T> var(const std::vector<int>& axes, bool keepdims = false, int ddof = 0) const;
+        // vector norm of order 1, 2 or infinity
+        NDArray<T> norm(int axis, T ord = 2, bool keepdims = false) const;
+        NDArray<T> norm(const std::vector<int>& axes, T ord = 2, bool keepdims = false) const;
+        // position of the largest (smallest) element along an axis, the
+        // first one on ties, stored as T
+        NDArray<T> argmax(int axis, bool keepdims = false) const;
+        NDArray<T> argmin(int axis, bool keepdims = false) const;
 
     private:
-        std::vector<T> data;
-        std::vector<int> shape_;
-        std::vector<int> strides_;
-        int size_;
-        int rank_;
+        template <typename U>
+        friend struct expr::Leaf;
+        // reads chunks straight into its buffers
+        friend class dataset::Stream<T>;
+
+        // shape constructor that leaves the elements uninitialized, for
+        // results that are about to be overwritten
+        struct Uninitialized {};
+        NDArray(dims::Dims shape, Uninitialized);
+        // reallocate to `size` elements keeping the leading ones
+        void resizeStorage(long size, T value);
+
+        // bit d set for every axis d in axes
+        unsigned long long axisMask(const std::vector<int>& axes) const;
+        // uninitialized result of a reduction over the axes in mask
+        NDArray<T> reduced(unsigned long long mask, bool keepdims) const;
+        // number of elements folded into each result of that reduction
+        long reducedCount(unsigned long long mask) const;
+        template <typename R>
+        NDArray<T> reduceAxes(const std::vector<int>& axes, bool keepdims) const;
+        template <bool Largest>
+        NDArray<T> argExtreme(int axis, bool keepdims) const;
+
+        // offset from ptr() of the element at the indices, from `axis` on
+        long offsetAt(int axis) const;
+        template <typename... I>
+        long offsetAt(int axis, long index, I... rest) const;
+        // write the last argument at the offset of the indices before it
+        void setAt(long offset, int axis, T value);
+        template <typename I, typename V, typename... A>
+        void setAt(long offset, int axis, I index, V next, A... rest);
+
+        // first element of this array or view
+        T* ptr();
+        const T* ptr() const;
+        bool contiguous() const;
+        // flat row-major index -> element offset from ptr()
+        long offsetOf(long index) const;
+        // call fn(start, n, stride) for each innermost row, start relative to ptr()
+        template <typename F>
+        void forEachRow(F fn) const;
+        // write the elements in row-major order to dst
+        void copyTo(T* dst) const;
+        // give this array its own contiguous storage
+        void detach();
+        // detach unless this array already owns all of its storage
+        void own();
+        // unshare(), returning the buffer moved away from (null if none)
+        // so that pointers into it stay valid while the caller needs them
+        std::shared_ptr<alloc::Buffer<T> > copyOnWrite();
+        // write e into this array, through a temporary if e reads these
+        // elements through a different layout
+        template <typename E, typename Op>
+        void evaluate(const E& e, Op op);
+        // e read as if stretched to this array's shape (NumPy broadcasting),
+        // for the in-place operators
+        template <typename E>
+        E broadcastTo(const E& e) const;
+        static dims::Dims rowMajorStrides(const dims::Dims& shape);
+
+        // An array and its views share one Storage; copies share its buffer
+        // but have a Storage of their own, which is what lets a write move
+        // the writer's views along with it.
+        struct Storage {
+            std::shared_ptr<alloc::Buffer<T> > buffer;
+        };
+        static std::shared_ptr<Storage> store(std::shared_ptr<alloc::Buffer<T> > buffer);
+
+        std::shared_ptr<Storage> data;
+        long offset_ = 0;
+        dims::Dims shape_;
+        dims::Dims strides_;
+        long size_ = 0;
+        int rank_ = 0;
 };
 
 // implementation
 template <typename T>
-NDArray<T>::NDArray(std::vector<int> shape) {
-    shape_ = shape;
-    rank_ = shape.size();
+NDArray<T>::NDArray(dims::Dims shape) : NDArray(std::move(shape), Uninitialized()) {
+    std::fill(ptr(), ptr() + size_, T());
+}
+
+template <typename T>
+NDArray<T>::NDArray(dims::Dims shape, Uninitialized) {
+    shape_ = std::move(shape);
+    rank_ = shape_.size();
     strides_.resize(rank_);
     strides_[rank_ - 1] = 1;
     size_ = 1;
@@ -130,13 +355,13 @@ NDArray<T>::NDArray(std::vector<int> shape) {
         size_ *= shape_[i];
     }
     size_ *= shape_[0];
-    data.resize(size_);
+    data = store(alloc::makeBuffer<T>(size_));
 }
 
 template <typename T>
-NDArray<T>::NDArray(std::vector<int> shape, std::vector<T> data) {
-    shape_ = shape;
-    rank_ = shape.size();
+NDArray<T>::NDArray(dims::Dims shape, std::vector<T> data) {
+    shape_ = std::move(shape);
+    rank_ = shape_.size();
     strides_.resize(rank_);
     strides_[rank_ - 1] = 1;
     size_ = 1;
@@ -145,220 +370,568 @@ NDArray<T>::NDArray(std::vector<int> shape, std::vector<T> data) {
         size_ *= shape_[i];
     }
     size_ *= shape_[0];
-    this->data = data;
+    this->data = store(alloc::makeBuffer<T>(size_));
+    long n = std::min((long)data.size(), size_);
+    std::copy(data.begin(), data.begin() + n, ptr());
+    std::fill(ptr() + n, ptr() + size_, T());
 
 }
-    
 
 template <typename T>
-NDArray<T>::~NDArray() {
-    data.clear();
-    shape_.clear();
-    strides_.clear();
+NDArray<T>::NDArray(const NDArray<T>& other)
+    : shape_(other.shape_), size_(other.size_), rank_(other.rank_) {
+    strides_ = rowMajorStrides(shape_);
+    if (other.data && other.offset_ == 0 && other.contiguous() && (long)other.data->buffer->size == size_) {
+        // the whole buffer in order, share it until either side writes
+        data = store(other.data->buffer);
+    }
+    else if (other.data) {
+        data = store(alloc::makeBuffer<T>(size_));
+        other.copyTo(ptr());
+    }
 }
 
+template <typename T>
+inline NDArray<T>::NDArray(NDArray<T>&& other)
+    : data(std::move(other.data)), offset_(other.offset_), shape_(std::move(other.shape_)),
+      strides_(std::move(other.strides_)), size_(other.size_), rank_(other.rank_) {
+    other.offset_ = 0;
+    other.size_ = 0;
+    other.rank_ = 0;
+}
 
 template <typename T>
-const T& NDArray<T>::operator[](const std::vector<int> index) const{
-    int offset = 0;
-    for (int i = 0; i < rank_; i++) {
-        offset += index[i] * strides_[i];
-    }
-    return data[offset];
+template <typename E>
+NDArray<T>::NDArray(const expr::Expr<E>& e) : NDArray(e.self().shape(), Uninitialized()) {
+    expr::evaluate(ptr(), shape_, strides_, true, e.self(), expr::Assign());
 }
 
 template <typename T>
-NDArray<T> NDArray<T>::operator[](int index) const{
-    std::vector<int> new_shape(shape_.begin() + 1, shape_.end());
-    std::vector<T> new_data(data.begin() + index * strides_[0], data.begin() + (index + 1) * strides_[0]);
-    return NDArray<T>(new_shape, new_data);
+inline NDArray<T>::~NDArray() {
+    data.reset();
+    shape_.clear();
+    strides_.clear();
 }
 
 template <typename T>
-T NDArray<T>::operator[](int index) {
-    // return the element at the given index
-    return data[index];
+inline T* NDArray<T>::ptr() {
+    return data ? data->buffer->data + offset_ : nullptr;
 }
 
 template <typename T>
-NDArray<T>& NDArray<T>::operator=(const NDArray<T>& other) {
-    this->data = other.data;
-    this->shape_ = other.shape_;
-    this->strides_ = other.strides_;
-    this->size_ = other.size_;
-    this->rank_ = other.rank_;
-    return *this;
+inline const T* NDArray<T>::ptr() const {
+    return data ? data->buffer->data + offset_ : nullptr;
 }
 
 template <typename T>
-bool NDArray<T>::operator==(const NDArray<T>& arr) {
-    if (this->shape_ != arr.shape_) {
-        return false;
-    }
-    for (int i = 0; i < this->size_; i++) {
-        if (this->data[i] != arr.data[i]) {
+dims::Dims NDArray<T>::rowMajorStrides(const dims::Dims& shape) {
+    dims::Dims strides(shape.size());
+    long stride = 1;
+    for (int i = (int)shape.size() - 1; i >= 0; i--) {
+        strides[i] = stride;
+        stride *= shape[i];
+    }
+    return strides;
+}
+
+template <typename T>
+inline bool NDArray<T>::contiguous() const {
+    long expected = 1;
+    for (int i = rank_ - 1; i >= 0; i--) {
+        if (shape_[i] != 1 && strides_[i] != expected) {
             return false;
         }
+        expected *= shape_[i];
     }
     return true;
 }
 
 template <typename T>
-NDArray<T> NDArray<T>::operator+(const NDArray<T>& arr) {
-    // check if the shapes are the same
-    if (shape_ != arr.shape_) {
+void NDArray<T>::gatherRows(const NDArray<T>& src, const std::vector<long>& indices, long start) {
+    if (rank_ == 0 || src.rank_ != rank_ ||
+        !std::equal(shape_.begin() + 1, shape_.end(), src.shape_.begin() + 1)) {
         throw std::invalid_argument("Shapes are not the same");
     }
-    std::vector<T> new_data(size_);
-    for (int i = 0; i < size_; i++) {
-        new_data[i] = data[i] + arr.data[i];
+    if (start < 0 || start + shape_[0] > (long)indices.size()) {
+        throw std::out_of_range("Index out of range");
+    }
+    unshare();
+    long rowSize = shape_[0] == 0 ? 0 : size_ / shape_[0];
+    const NDArray<T>& self = *this;
+    if (rowSize == 0) {
+        return;
+    }
+    if (self[0].contiguous() && src[0].contiguous()) {
+        // dense rows, one block copy each. The rows are scattered, so the
+        // source of a later row is prefetched while this one is copied.
+        const int ahead = 8;
+        for (long i = 0; i < shape_[0]; i++) {
+#if defined(__GNUC__)
+            if (i + ahead < shape_[0]) {
+                __builtin_prefetch(src.ptr() + indices[start + i + ahead] * src.strides_[0]);
+            }
+#endif
+            const T* row = src.ptr() + indices[start + i] * src.strides_[0];
+            std::copy(row, row + rowSize, ptr() + i * strides_[0]);
+        }
+        return;
+    }
+    for (long i = 0; i < shape_[0]; i++) {
+        NDArray<T> row = self[i];
+        row = expr::Leaf<T>(src[indices[start + i]]);
     }
-    return NDArray<T>(shape_, new_data);
 }
 
 template <typename T>
-NDArray<T> NDArray<T>::operator+(const T scalar) {
-    std::vector<T> new_data(size_);
-    for (int i = 0; i < size_; i++) {
-        new_data[i] = data[i] + scalar;
+inline bool NDArray<T>::isContiguous() const {
+    return contiguous();
+}
+
+template <typename T>
+inline long NDArray<T>::offsetOf(long index) const {
+    if (contiguous()) {
+        return index;
+    }
+    long offset = 0;
+    for (int i = rank_ - 1; i >= 0; i--) {
+        offset += (index % shape_[i]) * strides_[i];
+        index /= shape_[i];
     }
-    return NDArray<T>(shape_, new_data);
+    return offset;
 }
 
 template <typename T>
-NDArray<T> NDArray<T>::operator-(const NDArray<T>& arr) {
-    // check if the shapes are the same
-    if (shape_ != arr.shape_) {
-        throw std::invalid_argument("Shapes are not the same");
+template <typename F>
+void NDArray<T>::forEachRow(F fn) const {
+    if (contiguous()) {
+        fn(0, size_, 1);
+        return;
+    }
+    expr::forEachRow(shape_, [&](const long* idx, long n) {
+        long start = 0;
+        for (int i = 0; i + 1 < rank_; i++) {
+            start += idx[i] * strides_[i];
+        }
+        fn(start, n, strides_[rank_ - 1]);
+    });
+}
+
+template <typename T>
+void NDArray<T>::copyTo(T* dst) const {
+    const T* src = ptr();
+    forEachRow([&](long start, long n, long stride) {
+        if (stride == 1) {
+            std::copy(src + start, src + start + n, dst);
+        }
+        else {
+            for (long j = 0; j < n; j++) {
+                dst[j] = src[start + j * stride];
+            }
+        }
+        dst += n;
+    });
+}
+
+template <typename T>
+void NDArray<T>::detach() {
+    std::shared_ptr<alloc::Buffer<T> > fresh = alloc::makeBuffer<T>(size_);
+    if (data) {
+        copyTo(fresh->data);
+    }
+    data = store(std::move(fresh));
+    offset_ = 0;
+    strides_ = rowMajorStrides(shape_);
+}
+
+template <typename T>
+void NDArray<T>::own() {
+    if (!data || data.use_count() != 1 || data->buffer.use_count() != 1 || data->buffer->readOnly ||
+        offset_ != 0 || !contiguous() || (long)data->buffer->size != size_) {
+        detach();
     }
-    std::vector<T> new_data(size_);
-    for (int i = 0; i < size_; i++) {
-        new_data[i] = data[i] - arr.data[i];
+}
+
+template <typename T>
+std::shared_ptr<alloc::Buffer<T> > NDArray<T>::copyOnWrite() {
+    if (!data || (data->buffer.use_count() == 1 && !data->buffer->readOnly)) {
+        return nullptr;
+    }
+    // the whole buffer, so that every view's offset and strides stay valid
+    const alloc::Buffer<T>& shared = *data->buffer;
+    std::shared_ptr<alloc::Buffer<T> > fresh = alloc::makeBuffer<T>(shared.size);
+    std::copy(shared.data, shared.data + shared.size, fresh->data);
+    std::swap(data->buffer, fresh);
+    return fresh;
+}
+
+template <typename T>
+inline void NDArray<T>::unshare() {
+    copyOnWrite();
+}
+
+template <typename T>
+std::shared_ptr<typename NDArray<T>::Storage> NDArray<T>::store(std::shared_ptr<alloc::Buffer<T> > buffer) {
+    // from the same allocator as the elements, like the buffer's own control block
+    Storage storage = {std::move(buffer)};
+    return std::allocate_shared<Storage>(alloc::Adapter<Storage>(alloc::current()), std::move(storage));
+}
+
+template <typename T>
+void NDArray<T>::resizeStorage(long size, T value) {
+    if ((long)data->buffer->size == size) {
+        return;
+    }
+    std::shared_ptr<alloc::Buffer<T> > fresh = alloc::makeBuffer<T>(size);
+    long n = std::min((long)data->buffer->size, size);
+    std::copy(data->buffer->data, data->buffer->data + n, fresh->data);
+    std::fill(fresh->data + n, fresh->data + size, value);
+    data->buffer = std::move(fresh);
+}
+
+template <typename T>
+template <typename E>
+E NDArray<T>::broadcastTo(const E& e) const {
+    E x = e;
+    if (!E::scalar && x.shape() != shape_) {
+        // the operand may be stretched, this array may not
+        if (expr::broadcastShape(shape_, x.shape()) != shape_) {
+            throw std::invalid_argument("Shapes cannot be broadcast together");
+        }
+        x.broadcast(shape_);
     }
-    return NDArray<T>(shape_, new_data);
+    return x;
+}
+
+template <typename T>
+template <typename E, typename Op>
+void NDArray<T>::evaluate(const E& e, Op op) {
+    // e may read the buffer this array moves away from, keep it until done
+    std::shared_ptr<alloc::Buffer<T> > previous = copyOnWrite();
+    if (e.overlaps(data ? data->buffer.get() : nullptr, ptr(), strides_)) {
+        NDArray<T> result(e);
+        expr::evaluate(ptr(), shape_, strides_, contiguous(), expr::Leaf<T>(result), op);
+        return;
+    }
+    expr::evaluate(ptr(), shape_, strides_, contiguous(), e, op);
 }
 
+
 template <typename T>
-NDArray<T> NDArray<T>::operator-(const T scalar) {
-    std::vector<T> new_data(size_);
-    for (int i = 0; i < size_; i++) {
-        new_data[i] = data[i] - scalar;
+inline const T& NDArray<T>::operator[](const std::vector<long> index) const{
+    long offset = 0;
+    for (int i = 0; i < rank_; i++) {
+        offset += index[i] * strides_[i];
     }
-    return NDArray<T>(shape_, new_data);
+    return ptr()[offset];
 }
 
 template <typename T>
-NDArray<T> NDArray<T>::operator-= (const NDArray<T>& arr) {
-    // check if the shapes are the same
-    if (shape_ != arr.shape_) {
-        throw std::invalid_argument("Shapes are not the same");
+inline long NDArray<T>::offsetAt(int) const {
+    return 0;
+}
+
+template <typename T>
+template <typename... I>
+inline long NDArray<T>::offsetAt(int axis, long index, I... rest) const {
+    return index * strides_[axis] + offsetAt(axis + 1, rest...);
+}
+
+template <typename T>
+template <typename... I>
+inline typename std::enable_if<dims::Indices<I...>::value, const T&>::type NDArray<T>::at(I... index) const {
+    if ((int)sizeof...(I) != rank_) {
+        throw std::invalid_argument("Wrong number of indices");
     }
-    for (int i = 0; i < size_; i++) {
-        data[i] -= arr.data[i];
+    return ptr()[offsetAt(0, index...)];
+}
+
+template <typename T>
+inline NDArray<T> NDArray<T>::operator[](long index) const{
+    NDArray<T> result;
+    result.data = data;
+    result.offset_ = offset_ + index * strides_[0];
+    result.shape_.assign(shape_.begin() + 1, shape_.end());
+    result.strides_.assign(strides_.begin() + 1, strides_.end());
+    result.rank_ = rank_ - 1;
+    result.size_ = size_ / shape_[0];
+    return result;
+}
+
+template <typename T>
+inline T NDArray<T>::operator[](long index) {
+    // return the element at the given index
+    return ptr()[offsetOf(index)];
+}
+
+template <typename T>
+NDArray<T>& NDArray<T>::operator=(const NDArray<T>& other) {
+    if (this == &other) {
+        return *this;
     }
+    *this = NDArray<T>(other);
     return *this;
 }
 
 template <typename T>
-NDArray<T> NDArray<T>::operator-= (const T scalar) {
-    for (int i = 0; i < size_; i++) {
-        data[i] -= scalar;
-    }
+inline NDArray<T>& NDArray<T>::operator=(NDArray<T>&& other) {
+    this->data = std::move(other.data);
+    this->offset_ = other.offset_;
+    this->shape_ = std::move(other.shape_);
+    this->strides_ = std::move(other.strides_);
+    this->size_ = other.size_;
+    this->rank_ = other.rank_;
+    other.offset_ = 0;
+    other.size_ = 0;
+    other.rank_ = 0;
     return *this;
 }
 
+template <typename T>
+template <typename E>
+NDArray<T>& NDArray<T>::operator=(const expr::Expr<E>& e) {
+    if (!data || e.self().shape() != shape_) {
+        // new shape, evaluate into a fresh buffer since e may still read this array
+        *this = NDArray<T>(e);
+        return *this;
+    }
+    evaluate(e.self(), expr::Assign());
+    return *this;
+}
 
 template <typename T>
-NDArray<T> NDArray<T>::operator*(const NDArray<T>& arr) {
-    // check if the shapes are the same
-    if (shape_ != arr.shape_) {
-        throw std::invalid_argument("Shapes are not the same");
+bool NDArray<T>::operator==(const NDArray<T>& arr) {
+    if (this->shape_ != arr.shape_) {
+        return false;
     }
-    std::vector<T> new_data(size_);
-    for (int i = 0; i < size_; i++) {
-        new_data[i] = data[i] * arr.data[i];
+    if (contiguous() && arr.contiguous()) {
+        return std::equal(ptr(), ptr() + size_, arr.ptr());
     }
-    return NDArray<T>(shape_, new_data);
+    return toVector() == NDArray<T>(arr).toVector();
 }
 
 template <typename T>
-NDArray<T> NDArray<T>::operator/(const NDArray<T>& arr) {
-    // check if the shapes are the same
-    if (shape_ != arr.shape_) {
-        throw std::invalid_argument("Shapes are not the same");
-    }
-    std::vector<T> new_data(size_);
-    for (int i = 0; i < size_; i++) {
-        new_data[i] = data[i] / arr.data[i];
-    }
-    return NDArray<T>(shape_, new_data);
+NDArray<T>& NDArray<T>::operator+= (const NDArray<T>& arr) {
+    evaluate(broadcastTo(expr::Leaf<T>(arr)), expr::AddAssign());
+    return *this;
 }
 
 template <typename T>
-NDArray<T> NDArray<T>::operator*(T value) {
-    std::vector<T> new_data(size_);
-    for (int i = 0; i < size_; i++) {
-        new_data[i] = data[i] * value;
-    }
-    return NDArray<T>(shape_, new_data);
+NDArray<T>& NDArray<T>::operator-= (const NDArray<T>& arr) {
+    evaluate(broadcastTo(expr::Leaf<T>(arr)), expr::SubAssign());
+    return *this;
 }
 
+template <typename T>
+NDArray<T>& NDArray<T>::operator*= (const NDArray<T>& arr) {
+    evaluate(broadcastTo(expr::Leaf<T>(arr)), expr::MulAssign());
+    return *this;
+}
 
 template <typename T>
-NDArray<T> NDArray<T>::operator/(T value) {
-    std::vector<T> new_data(size_);
-    for (int i = 0; i < size_; i++) {
-        new_data[i] = data[i] / value;
-    }
-    return NDArray<T>(shape_, new_data);
+NDArray<T>& NDArray<T>::operator/= (const NDArray<T>& arr) {
+    evaluate(broadcastTo(expr::Leaf<T>(arr)), expr::DivAssign());
+    return *this;
+}
+
+template <typename T>
+NDArray<T>& NDArray<T>::operator+= (const T scalar) {
+    evaluate(expr::Scalar<T>(scalar), expr::AddAssign());
+    return *this;
+}
+
+template <typename T>
+NDArray<T>& NDArray<T>::operator-= (const T scalar) {
+    evaluate(expr::Scalar<T>(scalar), expr::SubAssign());
+    return *this;
+}
+
+template <typename T>
+NDArray<T>& NDArray<T>::operator*= (const T scalar) {
+    evaluate(expr::Scalar<T>(scalar), expr::MulAssign());
+    return *this;
+}
+
+template <typename T>
+NDArray<T>& NDArray<T>::operator/= (const T scalar) {
+    evaluate(expr::Scalar<T>(scalar), expr::DivAssign());
+    return *this;
+}
+
+template <typename T>
+template <typename E>
+NDArray<T>& NDArray<T>::operator+= (const expr::Expr<E>& e) {
+    evaluate(broadcastTo(e.self()), expr::AddAssign());
+    return *this;
+}
+
+template <typename T>
+template <typename E>
+NDArray<T>& NDArray<T>::operator-= (const expr::Expr<E>& e) {
+    evaluate(broadcastTo(e.self()), expr::SubAssign());
+    return *this;
+}
+
+template <typename T>
+template <typename E>
+NDArray<T>& NDArray<T>::operator*= (const expr::Expr<E>& e) {
+    evaluate(broadcastTo(e.self()), expr::MulAssign());
+    return *this;
+}
+
+template <typename T>
+template <typename E>
+NDArray<T>& NDArray<T>::operator/= (const expr::Expr<E>& e) {
+    evaluate(broadcastTo(e.self()), expr::DivAssign());
+    return *this;
+}
+
+template <typename T>
+NDArray<T>& NDArray<T>::axpy(T alpha, const NDArray<T>& x) {
+    return *this += x * alpha;
+}
+
+template <typename T>
+NDArray<T>& NDArray<T>::expInPlace() {
+    evaluate(exp(), expr::Assign());
+    return *this;
+}
+
+template <typename T>
+NDArray<T>& NDArray<T>::absInPlace() {
+    evaluate(abs(), expr::Assign());
+    return *this;
+}
+
+template <typename T>
+NDArray<T>& NDArray<T>::invInPlace() {
+    evaluate(inv(), expr::Assign());
+    return *this;
 }
 
 template <typename T>
-void NDArray<T>::set(std::vector<int> index, T value) {
-    int offset = 0;
+NDArray<T>& NDArray<T>::powInPlace(int power) {
+    evaluate(pow(power), expr::Assign());
+    return *this;
+}
+
+template <typename T>
+inline void NDArray<T>::set(std::vector<long> index, T value) {
+    long offset = 0;
     for (int i = 0; i < rank_; i++) {
         offset += index[i] * strides_[i];
     }
-    data[offset] = value;
+    unshare();
+    ptr()[offset] = value;
+}
+
+template <typename T>
+template <typename... A>
+inline typename std::enable_if<dims::IndicesThenValue<T, A...>::value>::type NDArray<T>::set(A... args) {
+    if ((int)sizeof...(A) - 1 != rank_) {
+        throw std::invalid_argument("Wrong number of indices");
+    }
+    unshare();
+    setAt(0, 0, args...);
+}
+
+template <typename T>
+inline void NDArray<T>::setAt(long offset, int, T value) {
+    ptr()[offset] = value;
 }
 
 template <typename T>
-NDArray<T> NDArray<T>::matMult(const NDArray<T>& arr) {
+template <typename I, typename V, typename... A>
+inline void NDArray<T>::setAt(long offset, int axis, I index, V next, A... rest) {
+    setAt(offset + (long)index * strides_[axis], axis + 1, next, rest...);
+}
+
+template <typename T>
+NDArray<T> NDArray<T>::matMult(const NDArray<T>& arr) const {
+    return matMult(arr, false, false);
+}
+
+template <typename T>
+NDArray<T> NDArray<T>::matMult(const NDArray<T>& arr, bool transA, bool transB) const {
     // Matrix multiplication
     // check if the shapes make sense
-    if (shape_[1] != arr.shape_[0]) {
+    long m = transA ? shape_[1] : shape_[0];
+    long k = transA ? shape_[0] : shape_[1];
+    long n = transB ? arr.shape_[0] : arr.shape_[1];
+    if (k != (transB ? arr.shape_[1] : arr.shape_[0])) {
         throw std::invalid_argument("Shapes are not compatible");
     }
-    // std::vector<int> new_shape = {shape_[0], arr.shape_[1]};
-    // std::vector<T> new_data(new_shape[0] * new_shape[1]);
-    // for (int i = 0; i < new_shape[0]; i++) {
-    //     for (int j = 0; j < new_shape[1]; j++) {
-    //         T sum = 0;
-    //         for (int k = 0; k < shape_[1]; k++) {
-    //             sum += (*this)[{i, k}] * arr[{k, j}];
-    //         }
-    //         new_data[i * new_shape[1] + j] = sum;
-    //     }
-    // }
-
-    // cahche the data
-    T* data1 = &data[0];
-    T* data2 = (T*)&(arr.data)[0];
-    int m = shape_[0];
-    int n = arr.shape_[1];
-    int k = shape_[1];
-    std::vector<T> new_data(m * n);
-    T* new_data_ptr = new_data.data();
-    for (int i = 0; i < m; i++) {
-        for (int j = 0; j < n; j++) {
-            T sum = 0;
-            for (int l = 0; l < k; l++) {
-                sum += data1[i * k + l] * data2[l * n + j];
-            }
-            new_data_ptr[i * n + j] = sum;
-        }
+    // a transposed operand is the same storage with row and column strides
+    // swapped, views pass their own strides
+    long rsa = transA ? strides_[1] : strides_[0];
+    long csa = transA ? strides_[0] : strides_[1];
+    long rsb = transB ? arr.strides_[1] : arr.strides_[0];
+    long csb = transB ? arr.strides_[0] : arr.strides_[1];
+    const T* a = ptr();
+    const T* b = arr.ptr();
+
+    NDArray<T> result({m, n}, Uninitialized());
+    if (n == 1) {
+        // matrix * column vector, e.g. x.matMult(w) in predict
+        gemm::gemv<T>(m, k, T(1), a, rsa, csa, b, rsb, T(0), result.ptr(), 1);
     }
-    return NDArray<T>({m, n}, new_data);
+    else if (m == 1) {
+        // row vector * matrix is B^T * a
+        gemm::gemv<T>(n, k, T(1), b, csb, rsb, a, csa, T(0), result.ptr(), 1);
+    }
+    else {
+        // packed, cache blocked kernel from gemm.h
+        gemm::gemm<T>(m, n, k, T(1), a, rsa, csa, b, rsb, csb,
+                      T(0), result.ptr(), n, 1);
+    }
+    return result;
+}
+
+template <typename T>
+template <typename F>
+NDArray<T> NDArray<T>::forwardBackward(const NDArray<T>& v, NDArray<T>& r, F f, T* sums) const {
+    if (rank_ != 2 || v.rank_ != 2 || v.shape_[0] != shape_[1] || v.shape_[1] != 1) {
+        throw std::invalid_argument("Shapes are not compatible for forwardBackward");
+    }
+    long m = shape_[0];
+    long n = shape_[1];
+    if (r.shape_ != dims::Dims{m, 1} || !r.contiguous()) {
+        r = NDArray<T>({m, 1}, Uninitialized());
+    }
+    // the blocks of r are written concurrently, unshare it up front
+    r.unshare();
+    NDArray<T> result({n, 1}, Uninitialized());
+    gemm::gemvForwardBackward(m, n, ptr(), strides_[0], strides_[1], v.ptr(), v.strides_[0], r.ptr(),
+                              [&](long start, long rows) -> decltype(f(r, 0L)) {
+                                  NDArray<T> block = r.slice(0, start, start + rows);
+                                  return f(block, start);
+                              },
+                              result.ptr(), sums);
+    return result;
+}
+
+template <typename T>
+NDArray<T> NDArray<T>::gramWithIntercept(const NDArray<T>& y) const {
+    if (rank_ != 2 || y.size_ != shape_[0] || y.rank_ == 0) {
+        throw std::invalid_argument("Shapes are not compatible for gramWithIntercept");
+    }
+    int d = (int)shape_[1];
+    NDArray<T> result({d + 2, d + 2}, Uninitialized());
+    // y is an (m, 1) column or a vector, either way its first stride walks it
+    linalg::gramWithIntercept(shape_[0], d, ptr(), strides_[0], strides_[1], y.ptr(), y.strides_[0], result.ptr());
+    return result;
+}
+
+template <typename T>
+NDArray<T> NDArray<T>::gramWithIntercept(const NDArray<T>& y, const NDArray<T>& weights) const {
+    if (rank_ != 2 || y.size_ != shape_[0] || y.rank_ == 0 ||
+        weights.size_ != shape_[0] || weights.rank_ == 0) {
+        throw std::invalid_argument("Shapes are not compatible for gramWithIntercept");
+    }
+    int d = (int)shape_[1];
+    NDArray<T> result({d + 2, d + 2}, Uninitialized());
+    linalg::gramWithIntercept(shape_[0], d, ptr(), strides_[0], strides_[1], y.ptr(), y.strides_[0],
+                              result.ptr(), weights.ptr(), weights.strides_[0]);
+    return result;
 }
 
 template <typename T>
@@ -366,22 +939,24 @@ NDArray<T> NDArray<T>::tensProd(const NDArray<T>& arr) {
     // Tensor product
     // recursively call the function
     if (rank_ == 1) {
-        std::vector<int> new_shape = {shape_[0], arr.shape_[0]};
+        dims::Dims new_shape = {shape_[0], arr.shape_[0]};
         std::vector<T> new_data(new_shape[0] * new_shape[1]);
-        for (int i = 0; i < new_shape[0]; i++) {
-            for (int j = 0; j < new_shape[1]; j++) {
-                new_data[i * new_shape[1] + j] = data[i] * arr.data[j];
+        for (long i = 0; i < new_shape[0]; i++) {
+            for (long j = 0; j < new_shape[1]; j++) {
+                new_data[i * new_shape[1] + j] = ptr()[i * strides_[0]] * arr.ptr()[j * arr.strides_[0]];
             }
         }
         return NDArray<T>(new_shape, new_data);
     }
     else {
-        std::vector<int> new_shape = {shape_[0], arr.shape_[0]};
+        dims::Dims new_shape = {shape_[0], arr.shape_[0]};
         std::vector<T> new_data(new_shape[0] * new_shape[1]);
-        NDArray<T> temp = (*this)[0].tensProd(arr[0]);
-        for (int i = 0; i < new_shape[0]; i++) {
-            for (int j = 0; j < new_shape[1]; j++) {
-                temp = (*this)[i].tensProd(arr[j]);
+        // index through a const reference to get the sub-array, not an element
+        const NDArray<T>& self = *this;
+        NDArray<T> temp = self[0].tensProd(arr[0]);
+        for (long i = 0; i < new_shape[0]; i++) {
+            for (long j = 0; j < new_shape[1]; j++) {
+                temp = self[i].tensProd(arr[j]);
             }
         }
         return temp;
@@ -391,13 +966,37 @@ NDArray<T> NDArray<T>::tensProd(const NDArray<T>& arr) {
 template <typename T>
 NDArray<T> NDArray<T>::expandDims(int axis) {
     // expand the dimension of the array
-    std::vector<int> new_shape = shape_;
-    new_shape.insert(new_shape.begin() + axis, 1);
-    std::vector<T> new_data(size_);
-    for (int i = 0; i < size_; i++) {
-        new_data[i] = data[i];
+    NDArray<T> result;
+    result.data = data;
+    result.offset_ = offset_;
+    result.shape_ = shape_;
+    result.shape_.insert(result.shape_.begin() + axis, 1);
+    result.strides_ = strides_;
+    result.strides_.insert(result.strides_.begin() + axis, axis < rank_ ? strides_[axis] * shape_[axis] : 1);
+    result.rank_ = rank_ + 1;
+    result.size_ = size_;
+    return result;
+}
+
+template <typename T>
+NDArray<T> NDArray<T>::slice(int axis, long start, long stop, long step) const {
+    if (axis < 0 || axis >= rank_) {
+        throw std::out_of_range("Axis out of range");
     }
-    return NDArray<T>(new_shape, new_data);
+    stop = std::min(stop, shape_[axis]);
+    if (start < 0 || start > stop || step <= 0) {
+        throw std::out_of_range("Invalid slice");
+    }
+    NDArray<T> result;
+    result.data = data;
+    result.offset_ = offset_ + start * strides_[axis];
+    result.shape_ = shape_;
+    result.shape_[axis] = (stop - start + step - 1) / step;
+    result.strides_ = strides_;
+    result.strides_[axis] *= step;
+    result.rank_ = rank_;
+    result.size_ = shape_[axis] == 0 ? 0 : size_ / shape_[axis] * result.shape_[axis];
+    return result;
 }
 
 
@@ -408,19 +1007,19 @@ std::string NDArray<T>::str(int index) const {
     if (rank_ == 1) {
         str << "[";
         // print data in the array until index
-        for (int i = 0; i < data.size(); i++) {
-            if(i == data.size() - 1) {
-                str << data[i];
+        for (long i = 0; i < shape_[0]; i++) {
+            if(i == shape_[0] - 1) {
+                str << ptr()[i * strides_[0]];
             }
             else {
-                str << data[i] << ", ";
+                str << ptr()[i * strides_[0]] << ", ";
             }
         }
         str << "]";
     }
     else {
         str << "[";
-        for (int i = 0; i < shape_[0]; i++) {
+        for (long i = 0; i < shape_[0]; i++) {
             if (i == shape_[0] - 1) {
                 str << (*this)[i].str(index + 1);
             }
@@ -434,42 +1033,45 @@ std::string NDArray<T>::str(int index) const {
 }
 
 template <typename T>
-int NDArray<T>::size() {
+inline long NDArray<T>::size() const {
     return size_;
 }
 
 template <typename T>
-int NDArray<T>::size(int dim) {
+inline long NDArray<T>::size(int dim) const {
     return shape_[dim];
 }
 
 template <typename T>
-int NDArray<T>::rank() {
+inline int NDArray<T>::rank() const {
     return rank_;
 }
 
 template <typename T>
-std::vector<int> NDArray<T>::shape() {
+inline const dims::Dims& NDArray<T>::shape() const {
     return shape_;
 }
 
 template <typename T>
-std::vector<int> NDArray<T>::strides() {
+inline const dims::Dims& NDArray<T>::strides() const {
     return strides_;
 }
 
 template <typename T>
-void NDArray<T>::reshape(std::vector<int> shape) {
+void NDArray<T>::reshape(dims::Dims shape) {
     if (shape.size() != rank_) {
         throw "Shape size does not match rank";
     }
-    int size = 1;
+    long size = 1;
     for (int i = 0; i < rank_; i++) {
         size *= shape[i];
     }
     if (size != size_) {
         throw "Shape size does not match array size";
     }
+    if (!contiguous()) {
+        detach();
+    }
     shape_ = shape;
     strides_[rank_ - 1] = 1;
     for (int i = rank_ - 1; i > 0; i--) {
@@ -478,11 +1080,12 @@ void NDArray<T>::reshape(std::vector<int> shape) {
 }
 
 template <typename T>
-void NDArray<T>::resize(std::vector<int> shape) {
+void NDArray<T>::resize(dims::Dims shape) {
+    own();
     if (shape.size() != rank_) {
         throw "Shape size does not match rank";
     }
-    int size = 1;
+    long size = 1;
     for (int i = 0; i < rank_; i++) {
         size *= shape[i];
     }
@@ -491,18 +1094,25 @@ void NDArray<T>::resize(std::vector<int> shape) {
     for (int i = rank_ - 1; i > 0; i--) {
         strides_[i - 1] = strides_[i] * shape_[i];
     }
-    data.resize(size);
+    resizeStorage(size, T());
     size_ = size;
 }
 
 template <typename T>
-void NDArray<T>::resize(int size) {
-    data.resize(size);
+void NDArray<T>::resize(long size) {
+    own();
+    resizeStorage(size, T());
     size_ = size;
 }
 
 template <typename T>
-void NDArray<T>::resize(int size, int dim) {
+inline void NDArray<T>::resize(int size) {
+    resize((long)size);
+}
+
+template <typename T>
+void NDArray<T>::resize(long size, int dim) {
+    own();
     if (dim >= rank_) {
         throw "Dimension out of range";
     }
@@ -511,12 +1121,13 @@ void NDArray<T>::resize(int size, int dim) {
     for (int i = rank_ - 1; i > 0; i--) {
         strides_[i - 1] = strides_[i] * shape_[i];
     }
-    data.resize(size);
+    resizeStorage(size, T());
     size_ = size;
 }
 
 template <typename T>
-void NDArray<T>::resize(int size, int dim, T value) {
+void NDArray<T>::resize(long size, int dim, T value) {
+    own();
     if (dim >= rank_) {
         throw "Dimension out of range";
     }
@@ -525,12 +1136,13 @@ void NDArray<T>::resize(int size, int dim, T value) {
     for (int i = rank_ - 1; i > 0; i--) {
         strides_[i - 1] = strides_[i] * shape_[i];
     }
-    data.resize(size, value);
+    resizeStorage(size, value);
     size_ = size;
 }
 
 template <typename T>
-void NDArray<T>::resize(int size, int dim, T value, bool copy) {
+void NDArray<T>::resize(long size, int dim, T value, bool copy) {
+    own();
     if (dim >= rank_) {
         throw "Dimension out of range";
     }
@@ -539,12 +1151,13 @@ void NDArray<T>::resize(int size, int dim, T value, bool copy) {
     for (int i = rank_ - 1; i > 0; i--) {
         strides_[i - 1] = strides_[i] * shape_[i];
     }
-    data.resize(size, value);
+    resizeStorage(size, value);
     size_ = size;
 }
 
 template <typename T>
-void NDArray<T>::resize(int size, int dim, bool copy) {
+void NDArray<T>::resize(long size, int dim, bool copy) {
+    own();
     if (dim >= rank_) {
         throw "Dimension out of range";
     }
@@ -553,7 +1166,7 @@ void NDArray<T>::resize(int size, int dim, bool copy) {
     for (int i = rank_ - 1; i > 0; i--) {
         strides_[i - 1] = strides_[i] * shape_[i];
     }
-    data.resize(size);
+    resizeStorage(size, T());
     size_ = size;
 }
 
@@ -561,15 +1174,17 @@ void NDArray<T>::resize(int size, int dim, bool copy) {
 
 template <typename T>
 void NDArray<T>::resize(bool copy) {
-    data.resize(size_);
+    own();
+    resizeStorage(size_, T());
 }
 
 template <typename T>
-void NDArray<T>::resize(std::vector<int> shape, T value) {
+void NDArray<T>::resize(dims::Dims shape, T value) {
+    own();
     if (shape.size() != rank_) {
         throw "Shape size does not match rank";
     }
-    int size = 1;
+    long size = 1;
     for (int i = 0; i < rank_; i++) {
         size *= shape[i];
     }
@@ -578,16 +1193,17 @@ void NDArray<T>::resize(std::vector<int> shape, T value) {
     for (int i = rank_ - 1; i > 0; i--) {
         strides_[i - 1] = strides_[i] * shape_[i];
     }
-    data.resize(size, value);
+    resizeStorage(size, value);
     size_ = size;
 }
 
 template <typename T>
-void NDArray<T>::resize(std::vector<int> shape, T value, bool copy) {
+void NDArray<T>::resize(dims::Dims shape, T value, bool copy) {
+    own();
     if (shape.size() != rank_) {
         throw "Shape size does not match rank";
     }
-    int size = 1;
+    long size = 1;
     for (int i = 0; i < rank_; i++) {
         size *= shape[i];
     }
@@ -596,16 +1212,17 @@ void NDArray<T>::resize(std::vector<int> shape, T value, bool copy) {
     for (int i = rank_ - 1; i > 0; i--) {
         strides_[i - 1] = strides_[i] * shape_[i];
     }
-    data.resize(size, value);
+    resizeStorage(size, value);
     size_ = size;
 }
 
 template <typename T>
-void NDArray<T>::resize(std::vector<int> shape, bool copy) {
+void NDArray<T>::resize(dims::Dims shape, bool copy) {
+    own();
     if (shape.size() != rank_) {
         throw "Shape size does not match rank";
     }
-    int size = 1;
+    long size = 1;
     for (int i = 0; i < rank_; i++) {
         size *= shape[i];
     }
@@ -614,29 +1231,30 @@ void NDArray<T>::resize(std::vector<int> shape, bool copy) {
     for (int i = rank_ - 1; i > 0; i--) {
         strides_[i - 1] = strides_[i] * shape_[i];
     }
-    data.resize(size);
+    resizeStorage(size, T());
     size_ = size;
 }
 
 
 template <typename T>
-void NDArray<T>::resize(int size, bool copy) {
-    data.resize(size);
+void NDArray<T>::resize(long size, bool copy) {
+    own();
+    resizeStorage(size, T());
 }
 
 template <typename T>
 void NDArray<T>::fill(T value) {
-    std::fill(data.begin(), data.end(), value);
+    evaluate(expr::Scalar<T>(value), expr::Assign());
 }
 
 template <typename T>
 void NDArray<T>::fill(T value, bool copy) {
-    std::fill(data.begin(), data.end(), value);
+    evaluate(expr::Scalar<T>(value), expr::Assign());
 }
 
 template <typename T>
 void NDArray<T>::fill(bool copy) {
-    std::fill(data.begin(), data.end(), 0);
+    evaluate(expr::Scalar<T>(0), expr::Assign());
 }
 
 template <typename T>
@@ -644,15 +1262,17 @@ void NDArray<T>::copy(NDArray<T> &other) {
     if (other.size_ != size_) {
         throw "Size mismatch";
     }
-    data = other.data;
+    if (!contiguous()) {
+        detach();
+    }
+    unshare();
+    other.copyTo(ptr());
 }
 
 template <typename T>
 NDArray<T> NDArray<T>::flatten() {
-    NDArray<T> result({size_});
-    for (int i = 0; i < size_; i++) {
-        result.data[i] = data[i];
-    }
+    NDArray<T> result({size_}, Uninitialized());
+    copyTo(result.ptr());
     return result;
 }
 
@@ -662,18 +1282,18 @@ NDArray<T> NDArray<T>::transpose() {
     if (rank_ != 2) {
         throw "Transpose only works on 2d arrays";
     }
-    NDArray<T> result = NDArray<T>({shape_[1], shape_[0]});
-    for (int i = 0; i < shape_[0]; i++) {
-        for (int j = 0; j < shape_[1]; j++) {
-            result.data[j * shape_[0] + i] = data[i * shape_[1] + j];
-        }
-    }
-    return result;
+    return transpose(0, 1);
 }
 
 template <typename T>
 NDArray<T> NDArray<T>::transpose(int dim1, int dim2) {
-    NDArray<T> result = *this;
+    NDArray<T> result;
+    result.data = data;
+    result.offset_ = offset_;
+    result.shape_ = shape_;
+    result.strides_ = strides_;
+    result.size_ = size_;
+    result.rank_ = rank_;
     std::swap(result.shape_[dim1], result.shape_[dim2]);
     std::swap(result.strides_[dim1], result.strides_[dim2]);
     return result;
@@ -685,9 +1305,13 @@ void NDArray<T>::random() {
     std::random_device rd;
     std::mt19937 gen(rd());
     std::uniform_real_distribution<> dis(0, 1);
-    for (int i = 0; i < size_; i++) {
-        data[i] = dis(gen);
-    }
+    unshare();
+    T* p = ptr();
+    forEachRow([&](long start, long n, long stride) {
+        for (long j = 0; j < n; j++) {
+            p[start + j * stride] = dis(gen);
+        }
+    });
 }
 
 template <typename T>
@@ -696,114 +1320,374 @@ void NDArray<T>::random(T min, T max) {
     std::random_device rd;
     std::mt19937 gen(rd());
     std::uniform_real_distribution<> dis(min, max);
-    for (int i = 0; i < size_; i++) {
-        data[i] = dis(gen);
-    }
+    unshare();
+    T* p = ptr();
+    forEachRow([&](long start, long n, long stride) {
+        for (long j = 0; j < n; j++) {
+            p[start + j * stride] = dis(gen);
+        }
+    });
 }
 
 template <typename T>
 std::vector<T> NDArray<T>::toVector() {
-    return data;
+    std::vector<T> result(size_);
+    copyTo(result.data());
+    return result;
 }
 
 template <typename T>
-T NDArray<T>::dot(NDArray<T> &other) {
+void NDArray<T>::save(const std::string& path) const {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        throw std::runtime_error("npy: cannot open " + path);
+    }
+    // the empty array is stored with shape (0,), () would be one element
+    std::string header = npy::header(npy::descr<T>(), rank_ > 0 ? std::vector<long>(shape_) : std::vector<long>(1, 0));
+    out.write(header.data(), header.size());
+    if (data) {
+        const T* src = ptr();
+        std::vector<T> row;
+        forEachRow([&](long start, long n, long stride) {
+            if (stride == 1) {
+                out.write(reinterpret_cast<const char*>(src + start), n * sizeof(T));
+                return;
+            }
+            row.resize(n);
+            for (long j = 0; j < n; j++) {
+                row[j] = src[start + j * stride];
+            }
+            out.write(reinterpret_cast<const char*>(row.data()), n * sizeof(T));
+        });
+    }
+    if (!out) {
+        throw std::runtime_error("npy: cannot write " + path);
+    }
+}
+
+template <typename T>
+NDArray<T> NDArray<T>::load(const std::string& path, npy::Mode mode) {
+    NDArray<T> result;
+    // bytes of the file from the header on, either mapped or read
+    const char* bytes = nullptr;
+    std::size_t length = 0;
+    npy::Header header;
+#if defined(ALTENSOR_MMAP)
+    std::shared_ptr<npy::Mapping> file;
+    if (mode != npy::Mode::Copy) {
+        file = std::make_shared<npy::Mapping>(path, mode == npy::Mode::CopyOnWrite);
+        bytes = file->data();
+        length = file->length();
+        header = npy::parseHeader(bytes, length);
+    }
+#endif
+    std::ifstream in;
+    if (bytes == nullptr) {
+        in.open(path, std::ios::binary);
+        if (!in) {
+            throw std::runtime_error("npy: cannot open " + path);
+        }
+        header = npy::readHeader(in);
+    }
+
+    result.shape_ = npy::shapeOf<T>(header);
+    result.rank_ = result.shape_.size();
+    result.size_ = 1;
+    for (int i = 0; i < result.rank_; i++) {
+        result.size_ *= result.shape_[i];
+    }
+    // column-major files are read as they are, with reversed strides
+    if (header.fortranOrder) {
+        dims::Dims reversed(result.shape_.rbegin(), result.shape_.rend());
+        dims::Dims strides = rowMajorStrides(reversed);
+        result.strides_.assign(strides.rbegin(), strides.rend());
+    }
+    else {
+        result.strides_ = rowMajorStrides(result.shape_);
+    }
+    std::size_t bytesNeeded = (std::size_t)result.size_ * sizeof(T);
+
+#if defined(ALTENSOR_MMAP)
+    if (file) {
+        if (length < header.dataOffset + bytesNeeded) {
+            throw std::invalid_argument("npy: " + path + " is truncated");
+        }
+        const char* first = bytes + header.dataOffset;
+        if (header.dataOffset % alignof(T) == 0) {
+            std::shared_ptr<alloc::Buffer<T> > pages =
+                std::make_shared<alloc::Buffer<T> >((T*)first, result.size_, file);
+            pages->readOnly = mode == npy::Mode::ReadOnly;
+            result.data = store(std::move(pages));
+        }
+        else {
+            // misaligned elements cannot be used in place
+            result.data = store(alloc::makeBuffer<T>(result.size_));
+            std::memcpy(result.ptr(), first, bytesNeeded);
+        }
+        return result;
+    }
+#endif
+    result.data = store(alloc::makeBuffer<T>(result.size_));
+    in.read(reinterpret_cast<char*>(result.ptr()), bytesNeeded);
+    if ((std::size_t)in.gcount() != bytesNeeded) {
+        throw std::invalid_argument("npy: " + path + " is truncated");
+    }
+    return result;
+}
+
+template <typename T>
+T NDArray<T>::dot(NDArray<T> &other, reduce::Summation mode) {
     if (size_ != other.size_) {
         throw std::out_of_range("Size mismatch");
     }
-    T sum = 0;
-    for (int i = 0; i < size_; i++) {
-        sum += data[i] * other.data[i];
+    if (contiguous() && other.contiguous()) {
+        const T* a = ptr();
+        const T* b = other.ptr();
+        return reduce::sum<T>(size_, [a, b](long i) { return a[i] * b[i]; }, mode);
+    }
+    reduce::Stream<T> sum(mode);
+    for (long i = 0; i < size_; i++) {
+        sum.push((*this)[i] * other[i]);
     }
-    return sum;
+    return sum.result();
 }
 
 template <typename T>
-T NDArray<T>::sum() {
-    T sum = 0;
-    for (int i = 0; i < size_; i++) {
-        sum += data[i];
-    }
-    return sum;
+T NDArray<T>::sum(reduce::Summation mode) {
+    return expr::Leaf<T>(*this).sum(mode);
+}
+
+template <typename T>
+inline expr::Unary<expr::Round, expr::Leaf<T> > NDArray<T>::round() const {
+    return expr::Leaf<T>(*this).round();
+}
+
+template <typename T>
+inline expr::Unary<expr::Abs, expr::Leaf<T> > NDArray<T>::abs() const {
+    return expr::Leaf<T>(*this).abs();
+}
+
+template <typename T>
+inline expr::Unary<expr::Exp, expr::Leaf<T> > NDArray<T>::exp() const {
+    return expr::Leaf<T>(*this).exp();
+}
+
+template <typename T>
+inline expr::Unary<expr::Log, expr::Leaf<T> > NDArray<T>::log() const {
+    return expr::Leaf<T>(*this).log();
+}
+
+template <typename T>
+inline expr::Unary<expr::Log1p, expr::Leaf<T> > NDArray<T>::log1p() const {
+    return expr::Leaf<T>(*this).log1p();
 }
 
 template <typename T>
-NDArray<T> NDArray<T>::round() {
-    NDArray<T> result = *this;
-    for (int i = 0; i < size_; i++) {
-        result.data[i] = std::round(data[i]);
+inline expr::Unary<expr::Tanh, expr::Leaf<T> > NDArray<T>::tanh() const {
+    return expr::Leaf<T>(*this).tanh();
+}
+
+template <typename T>
+inline expr::Unary<expr::Sigmoid, expr::Leaf<T> > NDArray<T>::sigmoid() const {
+    return expr::Leaf<T>(*this).sigmoid();
+}
+
+template <typename T>
+inline expr::Unary<expr::LogSigmoid, expr::Leaf<T> > NDArray<T>::logSigmoid() const {
+    return expr::Leaf<T>(*this).logSigmoid();
+}
+
+template <typename T>
+inline expr::Unary<expr::Sqrt, expr::Leaf<T> > NDArray<T>::sqrt() const {
+    return expr::Leaf<T>(*this).sqrt();
+}
+
+template <typename T>
+inline expr::Unary<expr::Pow, expr::Leaf<T> > NDArray<T>::pow(int exponent) const {
+    return expr::Leaf<T>(*this).pow(exponent);
+}
+
+template <typename T>
+inline expr::Unary<expr::Inv, expr::Leaf<T> > NDArray<T>::inv() const {
+    return expr::Leaf<T>(*this).inv();
+}
+
+template <typename T>
+inline expr::Binary<expr::Eq, expr::Leaf<T>, expr::Leaf<T> > NDArray<T>::eq(const NDArray<T> &other) const {
+    return expr::Leaf<T>(*this).eq(other);
+}
+
+template <typename T>
+unsigned long long NDArray<T>::axisMask(const std::vector<int>& axes) const {
+    if (rank_ > reduce::maxRank) {
+        throw std::invalid_argument("Too many dimensions to reduce");
+    }
+    unsigned long long mask = 0;
+    for (int axis : axes) {
+        if (axis < -rank_ || axis >= rank_) {
+            throw std::out_of_range("Axis out of range");
+        }
+        if (axis < 0) {
+            axis += rank_;
+        }
+        if (mask >> axis & 1) {
+            throw std::invalid_argument("Repeated axis");
+        }
+        mask |= 1ULL << axis;
     }
-    return result;
+    return mask;
 }
 
 template <typename T>
-NDArray<T> NDArray<T>::abs() {
-    NDArray<T> result = *this;
-    for (int i = 0; i < size_; i++) {
-        result.data[i] = std::abs(data[i]);
+NDArray<T> NDArray<T>::reduced(unsigned long long mask, bool keepdims) const {
+    dims::Dims shape;
+    for (int d = 0; d < rank_; d++) {
+        if (!(mask >> d & 1)) {
+            shape.push_back(shape_[d]);
+        }
+        else if (keepdims) {
+            shape.push_back(1);
+        }
     }
-    return result;
+    if (shape.empty()) {
+        shape.push_back(1);
+    }
+    return NDArray<T>(shape, Uninitialized());
 }
 
 template <typename T>
-NDArray<T> NDArray<T>::exp() {
-    NDArray<T> result = *this;
-    for (int i = 0; i < size_; i++) {
-        result.data[i] = std::exp(data[i]);
+long NDArray<T>::reducedCount(unsigned long long mask) const {
+    long count = 1;
+    for (int d = 0; d < rank_; d++) {
+        if (mask >> d & 1) {
+            count *= shape_[d];
+        }
     }
+    return count;
+}
+
+template <typename T>
+template <typename R>
+NDArray<T> NDArray<T>::reduceAxes(const std::vector<int>& axes, bool keepdims) const {
+    unsigned long long mask = axisMask(axes);
+    NDArray<T> result = reduced(mask, keepdims);
+    reduce::reduce<R, false>(ptr(), rank_, shape_.data(), strides_.data(), mask, result.ptr());
     return result;
 }
 
 template <typename T>
-NDArray<T> NDArray<T>::pow(int exponent) {
-    NDArray<T> result = *this;
-    for (int i = 0; i < size_; i++) {
-        result.data[i] = std::pow(data[i], exponent);
-    }
+NDArray<T> NDArray<T>::sum(int axis, bool keepdims) const {
+    return sum(std::vector<int>{axis}, keepdims);
+}
+
+template <typename T>
+NDArray<T> NDArray<T>::sum(const std::vector<int>& axes, bool keepdims) const {
+    return reduceAxes<reduce::Sum>(axes, keepdims);
+}
+
+template <typename T>
+NDArray<T> NDArray<T>::mean(int axis, bool keepdims) const {
+    return mean(std::vector<int>{axis}, keepdims);
+}
+
+template <typename T>
+NDArray<T> NDArray<T>::mean(const std::vector<int>& axes, bool keepdims) const {
+    NDArray<T> result = reduceAxes<reduce::Sum>(axes, keepdims);
+    reduce::divide(result.ptr(), result.size_, reducedCount(axisMask(axes)));
     return result;
 }
 
 template <typename T>
-NDArray<T> NDArray<T>::sum(int axis) {
-    if (axis >= rank_) {
-        throw std::out_of_range("Axis out of range");
-    }
-    NDArray<T> result = *this;
-    result.shape_.erase(result.shape_.begin() + axis);
-    result.strides_.erase(result.strides_.begin() + axis);
-    result.rank_--;
-    result.size_ = result.size_ / shape_[axis];
-    for (int i = 0; i < result.size_; i++) {
-        result.data[i] = 0;
+NDArray<T> NDArray<T>::min(int axis, bool keepdims) const {
+    return min(std::vector<int>{axis}, keepdims);
+}
+
+template <typename T>
+NDArray<T> NDArray<T>::min(const std::vector<int>& axes, bool keepdims) const {
+    if (reducedCount(axisMask(axes)) == 0) {
+        throw std::invalid_argument("Minimum over an empty axis");
     }
-    for (int i = 0; i < size_; i++) {
-        int index = i / strides_[axis] % shape_[axis];
-        result.data[i / strides_[axis + 1]] += data[i];
+    return reduceAxes<reduce::Min>(axes, keepdims);
+}
+
+template <typename T>
+NDArray<T> NDArray<T>::max(int axis, bool keepdims) const {
+    return max(std::vector<int>{axis}, keepdims);
+}
+
+template <typename T>
+NDArray<T> NDArray<T>::max(const std::vector<int>& axes, bool keepdims) const {
+    if (reducedCount(axisMask(axes)) == 0) {
+        throw std::invalid_argument("Maximum over an empty axis");
     }
+    return reduceAxes<reduce::Max>(axes, keepdims);
+}
+
+template <typename T>
+NDArray<T> NDArray<T>::var(int axis, bool keepdims, int ddof) const {
+    return var(std::vector<int>{axis}, keepdims, ddof);
+}
+
+template <typename T>
+NDArray<T> NDArray<T>::var(const std::vector<int>& axes, bool keepdims, int ddof) const {
+    unsigned long long mask = axisMask(axes);
+    long count = reducedCount(mask);
+    // the means, then the squared deviations from them in place
+    NDArray<T> result = mean(axes, keepdims);
+    reduce::reduce<reduce::SumSquares, true>(ptr(), rank_, shape_.data(), strides_.data(), mask, result.ptr());
+    reduce::divide(result.ptr(), result.size_, count - ddof);
     return result;
 }
 
 template <typename T>
-NDArray<T> NDArray<T>::inv(){
-    NDArray<T> result = *this;
-    for (int i = 0; i < size_; i++) {
-        result.data[i] = 1 / data[i];
+NDArray<T> NDArray<T>::norm(int axis, T ord, bool keepdims) const {
+    return norm(std::vector<int>{axis}, ord, keepdims);
+}
+
+template <typename T>
+NDArray<T> NDArray<T>::norm(const std::vector<int>& axes, T ord, bool keepdims) const {
+    if (ord == T(1)) {
+        return reduceAxes<reduce::SumAbs>(axes, keepdims);
+    }
+    if (std::isinf(ord) && ord > 0) {
+        return reduceAxes<reduce::MaxAbs>(axes, keepdims);
+    }
+    if (ord != T(2)) {
+        throw std::invalid_argument("Norm order must be 1, 2 or infinity");
+    }
+    NDArray<T> result = reduceAxes<reduce::SumSquares>(axes, keepdims);
+    T* p = result.ptr();
+    for (long i = 0; i < result.size_; i++) {
+        p[i] = std::sqrt(p[i]);
     }
     return result;
 }
 
 template <typename T>
-NDArray<T> NDArray<T>::eq(NDArray<T> &other) {
-    if (size_ != other.size_) {
-        throw std::out_of_range("Size mismatch");
+template <bool Largest>
+NDArray<T> NDArray<T>::argExtreme(int axis, bool keepdims) const {
+    unsigned long long mask = axisMask(std::vector<int>{axis});
+    if (reducedCount(mask) == 0) {
+        throw std::invalid_argument("Arg-extremum over an empty axis");
     }
-    NDArray<T> result = *this;
-    for (int i = 0; i < size_; i++) {
-        result.data[i] = data[i] == other.data[i];
+    if (axis < 0) {
+        axis += rank_;
     }
+    NDArray<T> result = reduced(mask, keepdims);
+    reduce::argExtreme<Largest>(ptr(), rank_, shape_.data(), strides_.data(), axis, result.ptr());
     return result;
 }
 
+template <typename T>
+NDArray<T> NDArray<T>::argmax(int axis, bool keepdims) const {
+    return argExtreme<true>(axis, keepdims);
+}
+
+template <typename T>
+NDArray<T> NDArray<T>::argmin(int axis, bool keepdims) const {
+    return argExtreme<false>(axis, keepdims);
+}
+
 template <typename T>
 std::string read_shape(NDArray<T> array) {
     std::stringstream os;
@@ -821,4 +1705,13 @@ std::string read_shape(NDArray<T> array) {
 template <typename T>
 using ndarray = NDArray<T>;
 
+// NDArray<float> and NDArray<double> are compiled once into srclib
+// (src/ndarray.cpp). Targets that link it get ALTENSOR_PRECOMPILED and only
+// instantiate the inline members and the member templates themselves;
+// without it the header stays self-contained.
+#if defined(ALTENSOR_PRECOMPILED)
+extern template class NDArray<float>;
+extern template class NDArray<double>;
+#endif
+
 #endif
\ No newline at end of file
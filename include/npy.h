@@ -0,0 +1,287 @@
+#ifndef NPY_H
+#define NPY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <climits>
+#include <istream>
+#include <new>
+#include <string>
+#include <vector>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+
+#include <alloc.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define ALTENSOR_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Array files in NumPy's .npy format, so arrays can be exchanged with
+// numpy.save/numpy.load.
+//
+// A file is the magic string "\x93NUMPY", a version byte pair, the length of
+// the header, and the header itself: a Python dict literal such as
+//
+//     {'descr': '<f8', 'fortran_order': False, 'shape': (3, 4), }
+//
+// padded with spaces so the elements that follow start at a multiple of 64
+// bytes. Versions 1.0 (16-bit header length), 2.0 (32-bit) and 3.0 (2.0 with
+// a UTF-8 header) are read; 1.0 is written unless the header is too long for
+// it. Only the machine's own byte order is read, and the element type must
+// match the array's: a float file does not load into NDArray<double>.
+//
+// Because the elements are stored aligned and in order, a file can be mapped
+// into memory and the array backed by the mapped pages (see Mode).
+namespace npy {
+
+// how NDArray<T>::load gets at the elements
+enum class Mode {
+    // read into storage from the calling thread's allocator
+    Copy,
+    // map the file shared and read-only: pages are read in as they are
+    // touched and nothing is copied; writing to the array first copies it
+    // into memory (see NDArray's copy-on-write)
+    ReadOnly,
+    // map the file privately: as cheap as ReadOnly until a page is written,
+    // which then gets its own copy; the file never changes
+    CopyOnWrite
+};
+
+// '<' or '>', the byte order of this machine
+inline char byteOrder() {
+    const std::uint16_t one = 1;
+    return *reinterpret_cast<const unsigned char*>(&one) == 1 ? '<' : '>';
+}
+
+// type string of T in this machine's byte order, e.g. "<f8" for double
+template <typename T>
+std::string descr() {
+    static_assert(std::is_arithmetic<T>::value, "npy files hold numbers");
+    std::string d(1, sizeof(T) == 1 ? '|' : byteOrder());
+    d += std::is_floating_point<T>::value ? 'f' : std::is_signed<T>::value ? 'i' : 'u';
+    d += std::to_string(sizeof(T));
+    return d;
+}
+
+const char magic[] = "\x93NUMPY";
+const std::size_t magicLength = 6;
+// the elements start at a multiple of this
+const std::size_t headerAlignment = 64;
+
+struct Header {
+    std::string descr;
+    bool fortranOrder = false;
+    std::vector<long long> shape;
+    // bytes before the first element
+    std::size_t dataOffset = 0;
+};
+
+// everything before the elements of an array of the given type and shape
+inline std::string header(const std::string& descr, const std::vector<long>& shape) {
+    std::string dict = "{'descr': '" + descr + "', 'fortran_order': False, 'shape': (";
+    for (std::size_t i = 0; i < shape.size(); i++) {
+        dict += std::to_string(shape[i]) + (shape.size() == 1 ? "," : i + 1 < shape.size() ? ", " : "");
+    }
+    dict += "), }";
+    std::size_t prefix = magicLength + 4;
+    std::size_t total = (prefix + dict.size() + 1 + headerAlignment - 1) / headerAlignment * headerAlignment;
+    bool version1 = total - prefix <= 0xffff;
+    if (!version1) {
+        prefix += 2;
+        total = (prefix + dict.size() + 1 + headerAlignment - 1) / headerAlignment * headerAlignment;
+    }
+    std::size_t length = total - prefix;
+    dict.append(length - dict.size() - 1, ' ');
+    dict += '\n';
+
+    std::string bytes(magic, magicLength);
+    bytes += (char)(version1 ? 1 : 2);
+    bytes += (char)0;
+    for (int i = 0; i < (version1 ? 2 : 4); i++) {
+        bytes += (char)((length >> (8 * i)) & 0xff);
+    }
+    return bytes + dict;
+}
+
+// offset of the elements, read from the first `length` bytes of a file; 12
+// bytes are enough for any version
+inline std::size_t dataOffset(const char* bytes, std::size_t length) {
+    if (length < magicLength + 4 || std::memcmp(bytes, magic, magicLength) != 0) {
+        throw std::invalid_argument("npy: not an array file");
+    }
+    const unsigned char* b = reinterpret_cast<const unsigned char*>(bytes);
+    int major = b[magicLength];
+    if (major == 1) {
+        return magicLength + 4 + (b[8] | (std::size_t)b[9] << 8);
+    }
+    if (major != 2 && major != 3) {
+        throw std::invalid_argument("npy: unsupported version " + std::to_string(major));
+    }
+    if (length < magicLength + 6) {
+        throw std::invalid_argument("npy: truncated header");
+    }
+    std::size_t n = 0;
+    for (int i = 3; i >= 0; i--) {
+        n = n << 8 | b[8 + i];
+    }
+    return magicLength + 6 + n;
+}
+
+// position just after `key`'s colon in the header dict
+inline std::size_t findValue(const std::string& dict, const char* key) {
+    std::size_t p = dict.find(std::string("'") + key + "'");
+    if (p == std::string::npos) {
+        p = dict.find(std::string("\"") + key + "\"");
+    }
+    if (p != std::string::npos) {
+        p = dict.find(':', p);
+    }
+    if (p == std::string::npos) {
+        throw std::invalid_argument(std::string("npy: header has no ") + key);
+    }
+    p++;
+    while (p < dict.size() && dict[p] == ' ') {
+        p++;
+    }
+    return p;
+}
+
+// the header at the start of a file, of which `length` bytes are available
+inline Header parseHeader(const char* bytes, std::size_t length) {
+    Header h;
+    h.dataOffset = dataOffset(bytes, length);
+    if (h.dataOffset > length) {
+        throw std::invalid_argument("npy: truncated header");
+    }
+    std::size_t start = bytes[magicLength] == 1 ? magicLength + 4 : magicLength + 6;
+    std::string dict(bytes + start, h.dataOffset - start);
+
+    std::size_t p = findValue(dict, "descr");
+    std::size_t end = p < dict.size() ? dict.find(dict[p], p + 1) : std::string::npos;
+    if (end == std::string::npos) {
+        throw std::invalid_argument("npy: bad descr");
+    }
+    h.descr = dict.substr(p + 1, end - p - 1);
+
+    p = findValue(dict, "fortran_order");
+    h.fortranOrder = dict.compare(p, 4, "True") == 0;
+
+    p = findValue(dict, "shape");
+    end = dict.find(')', p);
+    if (dict[p] != '(' || end == std::string::npos) {
+        throw std::invalid_argument("npy: bad shape");
+    }
+    for (p++; p < end; p++) {
+        if (dict[p] >= '0' && dict[p] <= '9') {
+            char* next;
+            h.shape.push_back(std::strtoll(dict.c_str() + p, &next, 10));
+            p = next - dict.c_str() - 1;
+        }
+    }
+    return h;
+}
+
+// the header of a file being read, leaving `in` at the first element
+inline Header readHeader(std::istream& in) {
+    // the fixed part gives the header's length, then read all of it
+    std::vector<char> bytes(magicLength + 6);
+    in.read(bytes.data(), bytes.size());
+    bytes.resize(dataOffset(bytes.data(), in.gcount()));
+    in.clear();
+    in.seekg(0);
+    in.read(bytes.data(), bytes.size());
+    return parseHeader(bytes.data(), in.gcount());
+}
+
+// throw unless the file holds elements of type T
+template <typename T>
+void checkDescr(const Header& h) {
+    std::string d = h.descr;
+    if (!d.empty() && (d[0] == '=' || (sizeof(T) == 1 && d[0] == '<'))) {
+        d[0] = descr<T>()[0];
+    }
+    if (d != descr<T>()) {
+        throw std::invalid_argument("npy: cannot read " + h.descr + " elements as " + descr<T>());
+    }
+}
+
+// the header's shape as an NDArray shape, checking that it holds elements of
+// type T ({} is a scalar, shape {1})
+template <typename T>
+std::vector<long> shapeOf(const Header& h) {
+    checkDescr<T>(h);
+    std::vector<long> shape;
+    long long size = 1;
+    for (std::size_t i = 0; i < h.shape.size(); i++) {
+        size *= h.shape[i];
+        if (h.shape[i] > LONG_MAX || size > LONG_MAX / (long long)sizeof(T)) {
+            throw std::invalid_argument("npy: array too large");
+        }
+        shape.push_back((long)h.shape[i]);
+    }
+    if (shape.empty()) {
+        shape.push_back(1);
+    }
+    return shape;
+}
+
+#if defined(ALTENSOR_MMAP)
+// A whole file mapped into memory, unmapped when the last array using it goes
+// away. It is the allocator of the buffers backed by it so that they keep it
+// alive; it never hands out memory itself.
+class Mapping : public alloc::Allocator {
+    public:
+        // map `path` read-only and shared, or privately (copy-on-write)
+        Mapping(const std::string& path, bool copyOnWrite) {
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0) {
+                throw std::runtime_error("npy: cannot open " + path);
+            }
+            struct stat st;
+            if (::fstat(fd, &st) != 0) {
+                ::close(fd);
+                throw std::runtime_error("npy: cannot stat " + path);
+            }
+            length_ = (std::size_t)st.st_size;
+            void* p = MAP_FAILED;
+            if (length_ > 0) {
+                p = ::mmap(nullptr, length_, copyOnWrite ? PROT_READ | PROT_WRITE : PROT_READ,
+                           copyOnWrite ? MAP_PRIVATE : MAP_SHARED, fd, 0);
+            }
+            ::close(fd);
+            if (p == MAP_FAILED) {
+                throw std::runtime_error("npy: cannot map " + path);
+            }
+            base_ = static_cast<char*>(p);
+        }
+        ~Mapping() {
+            ::munmap(base_, length_);
+        }
+        Mapping(const Mapping&) = delete;
+        Mapping& operator=(const Mapping&) = delete;
+
+        void* allocate(std::size_t) {
+            throw std::bad_alloc();
+        }
+        void deallocate(void*, std::size_t) {}
+
+        char* data() const { return base_; }
+        std::size_t length() const { return length_; }
+
+    private:
+        char* base_ = nullptr;
+        std::size_t length_ = 0;
+};
+#endif
+
+} // namespace npy
+
+#endif
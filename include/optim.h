@@ -0,0 +1,219 @@
+#ifndef OPTIM_H
+#define OPTIM_H
+
+#include <vector>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <algorithm>
+
+#include <ndarray.h>
+
+// First-order update rules for the regression models, and early stopping.
+//
+// An Optimizer turns a gradient into an in-place update of one parameter
+// array. Parameters are told apart by a slot number (the models use 0 for
+// the weights and 1 for the bias), and each keeps its own state: velocities,
+// running averages of squared gradients and so on. The state is allocated
+// once by init() before training and then only updated in place, so a
+// training loop never allocates for it:
+//
+//     model.setOptimizer(std::make_shared<optim::Adam<float> >());
+//     model.setEarlyStopping(1e-4, 5);
+//     model.fit(1000, 0.01);
+//
+// The learning rate is passed to every update, so it stays a property of
+// the model's fit() call.
+namespace optim {
+
+template <typename T>
+class Optimizer {
+    public:
+        virtual ~Optimizer() = default;
+        // zero the state of parameter `slot`, shaped like param
+        virtual void init(int slot, const NDArray<T>& param) = 0;
+        // one step on parameter `slot` against its gradient, in place
+        virtual void update(int slot, NDArray<T>& param, const NDArray<T>& grad, T lr) = 0;
+
+    protected:
+        // states[slot] = zeros shaped like param
+        static void zero(std::vector<NDArray<T> >& states, int slot, const NDArray<T>& param) {
+            if ((int)states.size() <= slot) {
+                states.resize(slot + 1);
+            }
+            states[slot] = NDArray<T>(param.shape());
+        }
+};
+
+// gradient descent with (optionally Nesterov) momentum:
+// v = momentum * v + g, then param -= lr * v, or lr * (g + momentum * v)
+template <typename T>
+class SGD : public Optimizer<T> {
+    public:
+        explicit SGD(T momentum = 0, bool nesterov = false) : momentum_(momentum), nesterov_(nesterov) {}
+
+        void init(int slot, const NDArray<T>& param) {
+            if (momentum_ != 0) {
+                this->zero(velocity_, slot, param);
+            }
+        }
+
+        void update(int slot, NDArray<T>& param, const NDArray<T>& grad, T lr) {
+            if (momentum_ == 0) {
+                param.axpy(-lr, grad);
+                return;
+            }
+            NDArray<T>& v = velocity_[slot];
+            v *= momentum_;
+            v += grad;
+            if (nesterov_) {
+                param -= (grad + v * momentum_) * lr;
+            }
+            else {
+                param.axpy(-lr, v);
+            }
+        }
+
+    private:
+        T momentum_;
+        bool nesterov_;
+        std::vector<NDArray<T> > velocity_;
+};
+
+// per-coordinate steps scaled by the root of all past squared gradients
+template <typename T>
+class Adagrad : public Optimizer<T> {
+    public:
+        explicit Adagrad(T epsilon = T(1e-8)) : epsilon_(epsilon) {}
+
+        void init(int slot, const NDArray<T>& param) {
+            this->zero(squares_, slot, param);
+        }
+
+        void update(int slot, NDArray<T>& param, const NDArray<T>& grad, T lr) {
+            NDArray<T>& s = squares_[slot];
+            s += grad * grad;
+            param -= grad * lr / (s.sqrt() + epsilon_);
+        }
+
+    private:
+        T epsilon_;
+        std::vector<NDArray<T> > squares_;
+};
+
+// Adagrad with an exponential moving average of the squared gradients
+template <typename T>
+class RMSProp : public Optimizer<T> {
+    public:
+        explicit RMSProp(T decay = T(0.9), T epsilon = T(1e-8)) : decay_(decay), epsilon_(epsilon) {}
+
+        void init(int slot, const NDArray<T>& param) {
+            this->zero(squares_, slot, param);
+        }
+
+        void update(int slot, NDArray<T>& param, const NDArray<T>& grad, T lr) {
+            NDArray<T>& s = squares_[slot];
+            s *= decay_;
+            s += grad * grad * (1 - decay_);
+            param -= grad * lr / (s.sqrt() + epsilon_);
+        }
+
+    private:
+        T decay_;
+        T epsilon_;
+        std::vector<NDArray<T> > squares_;
+};
+
+// moving averages of the gradient and its square, bias corrected (Kingma & Ba)
+template <typename T>
+class Adam : public Optimizer<T> {
+    public:
+        explicit Adam(T beta1 = T(0.9), T beta2 = T(0.999), T epsilon = T(1e-8))
+            : beta1_(beta1), beta2_(beta2), epsilon_(epsilon) {}
+
+        void init(int slot, const NDArray<T>& param) {
+            this->zero(first_, slot, param);
+            this->zero(second_, slot, param);
+            if ((int)steps_.size() <= slot) {
+                steps_.resize(slot + 1);
+            }
+            steps_[slot] = 0;
+        }
+
+        void update(int slot, NDArray<T>& param, const NDArray<T>& grad, T lr) {
+            NDArray<T>& m = first_[slot];
+            NDArray<T>& v = second_[slot];
+            int t = ++steps_[slot];
+            m *= beta1_;
+            m.axpy(1 - beta1_, grad);
+            v *= beta2_;
+            v += grad * grad * (1 - beta2_);
+            T correction1 = 1 - std::pow(beta1_, t);
+            T correction2 = 1 - std::pow(beta2_, t);
+            param -= m * (lr / correction1) / ((v * (1 / correction2)).sqrt() + epsilon_);
+        }
+
+    private:
+        T beta1_;
+        T beta2_;
+        T epsilon_;
+        std::vector<NDArray<T> > first_;
+        std::vector<NDArray<T> > second_;
+        std::vector<int> steps_;
+};
+
+// Decides when training has converged: once the gradient norm is at most
+// the tolerance, or once the loss has failed to improve on its best value
+// by more than minDelta for `patience` epochs in a row (patience 0 turns
+// that test off).
+template <typename T>
+class EarlyStopping {
+    public:
+        explicit EarlyStopping(T tolerance = 0, T minDelta = 0, int patience = 0)
+            : tolerance_(tolerance), minDelta_(minDelta), patience_(patience) {
+            reset();
+        }
+
+        void setTolerance(T tolerance) {
+            tolerance_ = tolerance;
+        }
+
+        void setPatience(T minDelta, int patience) {
+            minDelta_ = minDelta;
+            patience_ = patience;
+        }
+
+        // forget the losses seen so far, before a new fit
+        void reset() {
+            best_ = std::numeric_limits<T>::infinity();
+            stale_ = 0;
+        }
+
+        // record the loss and gradient norm of an epoch, true to stop
+        bool update(T loss, T gradientNorm) {
+            if (gradientNorm <= tolerance_) {
+                return true;
+            }
+            if (patience_ <= 0) {
+                return false;
+            }
+            if (loss < best_ - minDelta_) {
+                best_ = loss;
+                stale_ = 0;
+                return false;
+            }
+            best_ = std::min(best_, loss);
+            return ++stale_ >= patience_;
+        }
+
+    private:
+        T tolerance_;
+        T minDelta_;
+        int patience_;
+        T best_;
+        int stale_;
+};
+
+} // namespace optim
+
+#endif
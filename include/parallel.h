@@ -0,0 +1,201 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <exception>
+#include <algorithm>
+#include <cstdlib>
+
+// Shared worker pool for the parallel kernels.
+//
+// The number of threads used by a kernel is getNumThreads(): a per-thread
+// override set with setLocalNumThreads() if there is one, otherwise the global
+// value from setNumThreads(). The global value defaults to the
+// ALTENSOR_NUM_THREADS environment variable, or the hardware concurrency.
+namespace parallel {
+
+inline int defaultNumThreads() {
+    const char* env = std::getenv("ALTENSOR_NUM_THREADS");
+    if (env != nullptr && std::atoi(env) > 0) {
+        return std::atoi(env);
+    }
+    unsigned int hw = std::thread::hardware_concurrency();
+    return hw == 0 ? 1 : (int)hw;
+}
+
+inline std::atomic<int>& globalNumThreads() {
+    static std::atomic<int> threads(defaultNumThreads());
+    return threads;
+}
+
+inline int& localNumThreads() {
+    static thread_local int threads = 0;
+    return threads;
+}
+
+// set the number of threads used by every thread that has no local override
+inline void setNumThreads(int threads) {
+    globalNumThreads() = std::max(1, threads);
+}
+
+// set the number of threads used by kernels called from this thread,
+// 0 goes back to the global setting
+inline void setLocalNumThreads(int threads) {
+    localNumThreads() = std::max(0, threads);
+}
+
+inline int getNumThreads() {
+    int local = localNumThreads();
+    return local > 0 ? local : globalNumThreads().load();
+}
+
+class ThreadPool {
+    public:
+        static ThreadPool& instance() {
+            static ThreadPool pool;
+            return pool;
+        }
+
+        ~ThreadPool() {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stop_ = true;
+            }
+            wake_.notify_all();
+            for (size_t i = 0; i < workers_.size(); i++) {
+                workers_[i].join();
+            }
+        }
+
+        // call fn(0) ... fn(tasks - 1) on up to `threads` threads, the caller
+        // included, and return once every task has finished. Calls made from
+        // inside a task run serially on the calling worker.
+        void run(int tasks, int threads, const std::function<void(int)>& fn) {
+            if (tasks <= 0) {
+                return;
+            }
+            threads = std::min(threads, tasks);
+            if (threads <= 1 || inWorker()) {
+                for (int i = 0; i < tasks; i++) {
+                    fn(i);
+                }
+                return;
+            }
+
+            std::lock_guard<std::mutex> runLock(run_);
+            grow(threads - 1);
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                fn_ = &fn;
+                tasks_ = tasks;
+                next_ = 0;
+                helpers_ = threads - 1;
+                active_ = threads - 1;
+                error_ = nullptr;
+                generation_++;
+            }
+            wake_.notify_all();
+
+            inWorker() = true;
+            work();
+            inWorker() = false;
+
+            std::unique_lock<std::mutex> lock(mutex_);
+            done_.wait(lock, [this] { return active_ == 0; });
+            fn_ = nullptr;
+            if (error_) {
+                std::exception_ptr error = error_;
+                error_ = nullptr;
+                std::rethrow_exception(error);
+            }
+        }
+
+        int size() {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return (int)workers_.size();
+        }
+
+    private:
+        ThreadPool() = default;
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        static bool& inWorker() {
+            static thread_local bool worker = false;
+            return worker;
+        }
+
+        void grow(int workers) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            while ((int)workers_.size() < workers) {
+                int id = (int)workers_.size();
+                workers_.push_back(std::thread(&ThreadPool::loop, this, id));
+            }
+        }
+
+        void work() {
+            int i;
+            while ((i = next_.fetch_add(1)) < tasks_) {
+                try {
+                    (*fn_)(i);
+                }
+                catch (...) {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    if (!error_) {
+                        error_ = std::current_exception();
+                    }
+                }
+            }
+        }
+
+        void loop(int id) {
+            inWorker() = true;
+            unsigned long seen = 0;
+            for (;;) {
+                {
+                    std::unique_lock<std::mutex> lock(mutex_);
+                    wake_.wait(lock, [&] { return stop_ || generation_ != seen; });
+                    if (stop_) {
+                        return;
+                    }
+                    seen = generation_;
+                    if (id >= helpers_) {
+                        continue;
+                    }
+                }
+                work();
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (--active_ == 0) {
+                    done_.notify_one();
+                }
+            }
+        }
+
+        std::vector<std::thread> workers_;
+        std::mutex run_;
+        std::mutex mutex_;
+        std::condition_variable wake_;
+        std::condition_variable done_;
+        const std::function<void(int)>* fn_ = nullptr;
+        std::atomic<int> next_{0};
+        int tasks_ = 0;
+        int helpers_ = 0;
+        int active_ = 0;
+        unsigned long generation_ = 0;
+        bool stop_ = false;
+        std::exception_ptr error_;
+};
+
+// run fn(0) ... fn(tasks - 1) on the shared pool with getNumThreads() threads
+inline void parallelFor(int tasks, const std::function<void(int)>& fn) {
+    ThreadPool::instance().run(tasks, getNumThreads(), fn);
+}
+
+} // namespace parallel
+
+#endif
@@ -0,0 +1,630 @@
+#ifndef REDUCE_H
+#define REDUCE_H
+
+#include <vector>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <functional>
+#include <type_traits>
+
+#include <cpu.h>
+#include <parallel.h>
+
+// Reductions of a strided array over any set of its axes.
+//
+// The result is written row-major over the axes that are kept. Two loops
+// cover every case, picked so that memory is read in order:
+// - runs: each output element folds runs along a reduced axis into several
+//   independent accumulators, so contiguous runs vectorize without
+//   reassociating floating point;
+// - lanes: input rows along a kept axis are folded element by element into a
+//   block of outputs, a lane-parallel loop that vectorizes as written.
+// Large reductions are split over the thread pool by output elements. Each
+// output element is always reduced in the same order, so the result does not
+// depend on the thread count. Index bookkeeping lives on the stack, nothing
+// is allocated beyond the output.
+//
+// Full sums of a sequence (sum() and dot()) cut it into blocks of
+// `blockLength` elements, add each block with independent accumulators and
+// combine the block sums in a binary tree whose shape depends only on the
+// length. The error then grows with the log of the length instead of the
+// length, the block loop vectorizes, and threads can take whole subtrees
+// without changing a bit of the result. Summation::Compensated additionally
+// carries a Neumaier correction term in every accumulator, at two to four
+// times the cost.
+namespace reduce {
+
+const int maxRank = 32;
+// inputs with fewer elements are reduced on the calling thread
+const long parallelThreshold = 1L << 17;
+// output elements of a row handled together by the lane-parallel loop
+const int laneBlock = 256;
+// independent accumulators of the contiguous fold
+const int accumulators = 16;
+// elements added sequentially before the sums switch to a tree
+const int blockLength = 1024;
+// blocks per parallel task, a power of two so a task is a whole subtree
+const int chunkBlocks = 64;
+
+enum class Summation {
+    // blocked pairwise sum
+    Pairwise,
+    // pairwise over Neumaier-compensated blocks
+    Compensated
+};
+
+// A reducer folds elements into an accumulator starting from identity(), and
+// combines two partial results.
+struct Sum {
+    template <typename T> static T identity() { return T(0); }
+    template <typename T> static T fold(T acc, T x) { return acc + x; }
+    template <typename T> static T combine(T a, T b) { return a + b; }
+};
+
+struct SumSquares {
+    template <typename T> static T identity() { return T(0); }
+    template <typename T> static T fold(T acc, T x) { return acc + x * x; }
+    template <typename T> static T combine(T a, T b) { return a + b; }
+};
+
+struct SumAbs {
+    template <typename T> static T identity() { return T(0); }
+    template <typename T> static T fold(T acc, T x) { return acc + std::abs(x); }
+    template <typename T> static T combine(T a, T b) { return a + b; }
+};
+
+struct Max {
+    template <typename T> static T identity() {
+        return std::numeric_limits<T>::has_infinity ? -std::numeric_limits<T>::infinity()
+                                                    : std::numeric_limits<T>::lowest();
+    }
+    template <typename T> static T fold(T acc, T x) { return x > acc ? x : acc; }
+    template <typename T> static T combine(T a, T b) { return fold(a, b); }
+};
+
+struct Min {
+    template <typename T> static T identity() {
+        return std::numeric_limits<T>::has_infinity ? std::numeric_limits<T>::infinity()
+                                                    : std::numeric_limits<T>::max();
+    }
+    template <typename T> static T fold(T acc, T x) { return x < acc ? x : acc; }
+    template <typename T> static T combine(T a, T b) { return fold(a, b); }
+};
+
+struct MaxAbs {
+    template <typename T> static T identity() { return T(0); }
+    template <typename T> static T fold(T acc, T x) { return std::abs(x) > acc ? std::abs(x) : acc; }
+    template <typename T> static T combine(T a, T b) { return a > b ? a : b; }
+};
+
+// The axes of an array split into the kept ones and the reduced ones, with
+// axes of length 1 left out. The loop that reads memory in order is chosen
+// from the strides: runs along the reduced axis with the smallest stride if
+// that stride is smaller than any kept one, lanes along the kept axis with
+// the smallest stride otherwise.
+struct Plan {
+    // kept axes in order, with their strides in the input and in the
+    // row-major output
+    int keptRank = 0;
+    long keptShape[maxRank];
+    long keptStrides[maxRank];
+    long outStrides[maxRank];
+    // reduced axes by decreasing stride
+    int reducedRank = 0;
+    long reducedShape[maxRank];
+    long reducedStrides[maxRank];
+    // the kept axes other than the lane
+    int otherRank = 0;
+    long otherShape[maxRank];
+    long otherStrides[maxRank];
+    long otherOutStrides[maxRank];
+    // number of output elements, and of elements folded into each
+    long outputs = 1;
+    long count = 1;
+    // kept axis the lane loop runs along, -1 for the run loop
+    int lane = -1;
+
+    // `axes` has bit d set for every reduced axis d
+    Plan(int rank, const long* shape, const long* strides, unsigned long long axes) {
+        for (int d = 0; d < rank; d++) {
+            bool reduced = axes >> d & 1;
+            (reduced ? count : outputs) *= shape[d];
+            if (shape[d] == 1) {
+                continue;
+            }
+            if (reduced) {
+                // insertion by decreasing stride, stable
+                int k = reducedRank++;
+                for (; k > 0 && std::abs(reducedStrides[k - 1]) < std::abs(strides[d]); k--) {
+                    reducedShape[k] = reducedShape[k - 1];
+                    reducedStrides[k] = reducedStrides[k - 1];
+                }
+                reducedShape[k] = shape[d];
+                reducedStrides[k] = strides[d];
+            }
+            else {
+                keptShape[keptRank] = shape[d];
+                keptStrides[keptRank++] = strides[d];
+            }
+        }
+        long step = 1;
+        for (int k = keptRank - 1; k >= 0; k--) {
+            outStrides[k] = step;
+            step *= keptShape[k];
+        }
+        if (keptRank == 0) {
+            return;
+        }
+        int best = keptRank - 1;
+        for (int k = keptRank - 2; k >= 0; k--) {
+            if (std::abs(keptStrides[k]) < std::abs(keptStrides[best])) {
+                best = k;
+            }
+        }
+        if (reducedRank > 0 && std::abs(reducedStrides[reducedRank - 1]) < std::abs(keptStrides[best])) {
+            return;
+        }
+        lane = best;
+        for (int k = 0; k < keptRank; k++) {
+            if (k != lane) {
+                otherShape[otherRank] = keptShape[k];
+                otherStrides[otherRank] = keptStrides[k];
+                otherOutStrides[otherRank++] = outStrides[k];
+            }
+        }
+    }
+};
+
+// row-major walk over `rank` dimensions that tracks the element offset
+struct Counter {
+    int rank;
+    const long* shape;
+    const long* strides;
+    long idx[maxRank];
+    long offset = 0;
+
+    Counter(int rank, const long* shape, const long* strides, long start)
+        : rank(rank), shape(shape), strides(strides) {
+        for (int d = rank - 1; d >= 0; d--) {
+            idx[d] = start % shape[d];
+            start /= shape[d];
+            offset += idx[d] * strides[d];
+        }
+    }
+
+    void next() {
+        for (int d = rank - 1; d >= 0; d--) {
+            offset += strides[d];
+            if (++idx[d] < shape[d]) {
+                return;
+            }
+            offset -= strides[d] * shape[d];
+            idx[d] = 0;
+        }
+    }
+};
+
+// acc folded with the n elements p[0], p[s], ... (minus c when Centered)
+template <typename R, bool Centered, typename T>
+T foldRun(const T* p, long n, long s, T c, T acc) {
+    if (s != 1 || n < 2 * accumulators) {
+        for (long i = 0; i < n; i++) {
+            acc = R::fold(acc, Centered ? T(p[i * s] - c) : p[i * s]);
+        }
+        return acc;
+    }
+    T a[accumulators];
+    for (int k = 0; k < accumulators; k++) {
+        a[k] = R::template identity<T>();
+    }
+    long i = 0;
+    for (; i + accumulators <= n; i += accumulators) {
+        for (int k = 0; k < accumulators; k++) {
+            a[k] = R::fold(a[k], Centered ? T(p[i + k] - c) : p[i + k]);
+        }
+    }
+    for (int k = 0; i < n; i++, k++) {
+        a[k] = R::fold(a[k], Centered ? T(p[i] - c) : p[i]);
+    }
+    for (int width = accumulators / 2; width > 0; width /= 2) {
+        for (int k = 0; k < width; k++) {
+            a[k] = R::combine(a[k], a[k + width]);
+        }
+    }
+    return R::combine(acc, a[0]);
+}
+
+// outputs [o0, o1) with the run loop
+template <typename R, bool Centered, typename T>
+void reduceRuns(const T* in, const Plan& p, T* out, long o0, long o1) {
+    long n = p.reducedRank == 0 ? 1 : p.reducedShape[p.reducedRank - 1];
+    long s = p.reducedRank == 0 ? 0 : p.reducedStrides[p.reducedRank - 1];
+    long runs = n == 0 ? 0 : p.count / n;
+    Counter o(p.keptRank, p.keptShape, p.keptStrides, o0);
+    for (long i = o0; i < o1; i++, o.next()) {
+        T c = Centered ? out[i] : T(0);
+        T acc = R::template identity<T>();
+        Counter r(std::max(0, p.reducedRank - 1), p.reducedShape, p.reducedStrides, 0);
+        for (long k = 0; k < runs; k++, r.next()) {
+            acc = foldRun<R, Centered>(in + o.offset + r.offset, n, s, c, acc);
+        }
+        out[i] = acc;
+    }
+}
+
+// one block of `laneBlock` outputs along the lane, in row `row` of the
+// other kept axes, with the lane loop
+template <typename R, bool Centered, typename T>
+void reduceLanes(const T* in, const Plan& p, T* out, long row, long j0) {
+    long n = p.keptShape[p.lane];
+    long s = p.keptStrides[p.lane];
+    long so = p.outStrides[p.lane];
+    int lanes = (int)std::min<long>(laneBlock, n - j0);
+    Counter o(p.otherRank, p.otherShape, p.otherStrides, row);
+    Counter oo(p.otherRank, p.otherShape, p.otherOutStrides, row);
+    T* dst = out + oo.offset + j0 * so;
+    T acc[laneBlock];
+    T c[laneBlock];
+    for (int j = 0; j < lanes; j++) {
+        if (Centered) {
+            c[j] = dst[j * so];
+        }
+        acc[j] = R::template identity<T>();
+    }
+    Counter r(p.reducedRank, p.reducedShape, p.reducedStrides, 0);
+    for (long k = 0; k < p.count; k++, r.next()) {
+        const T* src = in + o.offset + r.offset + j0 * s;
+        if (s == 1) {
+            for (int j = 0; j < lanes; j++) {
+                acc[j] = R::fold(acc[j], Centered ? T(src[j] - c[j]) : src[j]);
+            }
+        }
+        else {
+            for (int j = 0; j < lanes; j++) {
+                acc[j] = R::fold(acc[j], Centered ? T(src[j * s] - c[j]) : src[j * s]);
+            }
+        }
+    }
+    for (int j = 0; j < lanes; j++) {
+        dst[j * so] = acc[j];
+    }
+}
+
+// the two loops compiled for the instruction set in use (see cpu.h)
+template <typename R, bool Centered>
+struct RunsKernel {
+    template <cpu::Isa L, typename T>
+    static void run(const T* in, const Plan& p, T* out, long o0, long o1) {
+        reduceRuns<R, Centered>(in, p, out, o0, o1);
+    }
+};
+
+template <typename R, bool Centered>
+struct LanesKernel {
+    template <cpu::Isa L, typename T>
+    static void run(const T* in, const Plan& p, T* out, long row, long j0) {
+        reduceLanes<R, Centered>(in, p, out, row, j0);
+    }
+};
+
+// run fn(0) ... fn(tasks - 1), on the pool if the reduction is large
+inline void run(long work, int tasks, const std::function<void(int)>& fn) {
+    if (work < parallelThreshold) {
+        for (int t = 0; t < tasks; t++) {
+            fn(t);
+        }
+        return;
+    }
+    parallel::parallelFor(tasks, fn);
+}
+
+// out = the reduction R of the array (rank, shape, strides) at `in` over the
+// axes set in `axes`, row-major over the kept axes. With Centered, out holds
+// a center per output element on entry that is subtracted from each element
+// before it is folded (the second pass of a variance).
+template <typename R, bool Centered, typename T>
+void reduce(const T* in, int rank, const long* shape, const long* strides, unsigned long long axes, T* out) {
+    Plan p(rank, shape, strides, axes);
+    if (p.outputs == 0) {
+        return;
+    }
+    if (p.lane < 0) {
+        // enough outputs per task to fold about 32k elements
+        long per = std::max(1L, 32768 / std::max(1L, p.count));
+        int tasks = (int)((p.outputs + per - 1) / per);
+        run(p.outputs * p.count, tasks, [&](int t) {
+            cpu::dispatch<RunsKernel<R, Centered> >(in, p, out, t * per, std::min(p.outputs, (t + 1) * per));
+        });
+        return;
+    }
+    long n = p.keptShape[p.lane];
+    long blocks = (n + laneBlock - 1) / laneBlock;
+    long rows = p.outputs / n;
+    run(p.outputs * p.count, (int)(rows * blocks), [&](int t) {
+        cpu::dispatch<LanesKernel<R, Centered> >(in, p, out, t / blocks, t % blocks * laneBlock);
+    });
+}
+
+// out[0, n) divided by d, the last step of a mean or a variance: a multiply
+// by the reciprocal for floating T, a division for integers (whose 1 / d is 0)
+template <typename T>
+void divide(T* out, long n, long d) {
+    if (std::is_floating_point<T>::value) {
+        T scale = T(1) / T(d);
+        for (long i = 0; i < n; i++) {
+            out[i] *= scale;
+        }
+    }
+    else {
+        for (long i = 0; i < n; i++) {
+            out[i] = T(out[i] / d);
+        }
+    }
+}
+
+// out = the index of the largest (Largest) or smallest element along `axis`,
+// the first one on ties, row-major over the other axes
+template <bool Largest, typename T>
+void argExtreme(const T* in, int rank, const long* shape, const long* strides, int axis, T* out) {
+    Plan p(rank, shape, strides, 1ULL << axis);
+    if (p.outputs == 0) {
+        return;
+    }
+    long m = shape[axis];
+    long sa = strides[axis];
+    if (p.lane < 0) {
+        long per = std::max(1L, 32768 / std::max(1L, m));
+        int tasks = (int)((p.outputs + per - 1) / per);
+        run(p.outputs * m, tasks, [&](int t) {
+            long o0 = t * per;
+            long o1 = std::min(p.outputs, o0 + per);
+            Counter o(p.keptRank, p.keptShape, p.keptStrides, o0);
+            for (long i = o0; i < o1; i++, o.next()) {
+                const T* src = in + o.offset;
+                long best = 0;
+                for (long k = 1; k < m; k++) {
+                    if (Largest ? src[k * sa] > src[best * sa] : src[k * sa] < src[best * sa]) {
+                        best = k;
+                    }
+                }
+                out[i] = T(best);
+            }
+        });
+        return;
+    }
+    long n = p.keptShape[p.lane];
+    long s = p.keptStrides[p.lane];
+    long so = p.outStrides[p.lane];
+    long blocks = (n + laneBlock - 1) / laneBlock;
+    long rows = p.outputs / n;
+    run(p.outputs * m, (int)(rows * blocks), [&](int t) {
+        long row = t / blocks;
+        long j0 = t % blocks * laneBlock;
+        int lanes = (int)std::min<long>(laneBlock, n - j0);
+        Counter o(p.otherRank, p.otherShape, p.otherStrides, row);
+        Counter oo(p.otherRank, p.otherShape, p.otherOutStrides, row);
+        const T* base = in + o.offset + j0 * s;
+        T* dst = out + oo.offset + j0 * so;
+        T best[laneBlock];
+        long index[laneBlock];
+        for (int j = 0; j < lanes; j++) {
+            best[j] = base[j * s];
+            index[j] = 0;
+        }
+        for (long k = 1; k < m; k++) {
+            const T* src = base + k * sa;
+            for (int j = 0; j < lanes; j++) {
+                T v = src[j * s];
+                if (Largest ? v > best[j] : v < best[j]) {
+                    best[j] = v;
+                    index[j] = k;
+                }
+            }
+        }
+        for (int j = 0; j < lanes; j++) {
+            dst[j * so] = T(index[j]);
+        }
+    });
+}
+
+// running sum, the state of a Summation::Pairwise accumulator
+template <typename T>
+struct Plain {
+    T sum = T(0);
+
+    void add(T x) { sum += x; }
+    void add(const Plain& other) { sum += other.sum; }
+    T value() const { return sum; }
+};
+
+// running sum with the rounding error of every addition kept apart
+// (Neumaier's variant of Kahan summation)
+template <typename T>
+struct Neumaier {
+    T sum = T(0);
+    T correction = T(0);
+
+    void add(T x) {
+        T t = sum + x;
+        bool larger = std::abs(sum) >= std::abs(x);
+        T big = larger ? sum : x;
+        T small = larger ? x : sum;
+        correction += (big - t) + small;
+        sum = t;
+    }
+    void add(const Neumaier& other) {
+        add(other.sum);
+        correction += other.correction;
+    }
+    T value() const { return sum + correction; }
+};
+
+// f(i0) + ... + f(i0 + n - 1), n <= blockLength, into independent accumulators
+template <typename S, typename F>
+S blockSum(const F& f, long i0, int n) {
+    S a[accumulators];
+    int i = 0;
+    for (; i + accumulators <= n; i += accumulators) {
+        for (int k = 0; k < accumulators; k++) {
+            a[k].add(f(i0 + i + k));
+        }
+    }
+    for (int k = 0; i < n; i++, k++) {
+        a[k].add(f(i0 + i));
+    }
+    for (int width = accumulators / 2; width > 0; width /= 2) {
+        for (int k = 0; k < width; k++) {
+            a[k].add(a[k + width]);
+        }
+    }
+    return a[0];
+}
+
+// Combines partial sums pushed in order into a balanced binary tree, like a
+// binary counter: two subtrees of the same size are merged as soon as both
+// exist, so at most one partial per level is kept.
+template <typename S>
+struct Cascade {
+    S levels[64];
+    int depth = 0;
+    unsigned long long count = 0;
+
+    void push(S x) {
+        for (unsigned long long k = count++; k & 1; k >>= 1) {
+            S left = levels[--depth];
+            left.add(x);
+            x = left;
+        }
+        levels[depth++] = x;
+    }
+
+    // the remaining partials combined from the most recent one, starting
+    // with `tail` (the partials of a shorter sequence that follows)
+    S result(S tail) const {
+        for (int l = depth - 1; l >= 0; l--) {
+            S left = levels[l];
+            left.add(tail);
+            tail = left;
+        }
+        return tail;
+    }
+
+    S result() const {
+        if (depth == 0) {
+            return S();
+        }
+        Cascade rest = *this;
+        S last = rest.levels[--rest.depth];
+        return rest.result(last);
+    }
+};
+
+// blocks [b0, b0 + blocks) of a sequence of length n, as a cascade
+template <typename S, typename F>
+Cascade<S> blockCascade(const F& f, long n, long b0, long blocks) {
+    Cascade<S> c;
+    for (long b = b0; b < b0 + blocks; b++) {
+        long i0 = b * blockLength;
+        c.push(blockSum<S>(f, i0, (int)std::min<long>(blockLength, n - i0)));
+    }
+    return c;
+}
+
+// blockSum and blockCascade compiled for the instruction set in use
+template <typename S>
+struct BlockKernel {
+    template <cpu::Isa L, typename F>
+    static S run(const F& f, long i0, int n) {
+        return blockSum<S>(f, i0, n);
+    }
+};
+
+template <typename S>
+struct CascadeKernel {
+    template <cpu::Isa L, typename F>
+    static Cascade<S> run(const F& f, long n, long b0, long blocks) {
+        return blockCascade<S>(f, n, b0, blocks);
+    }
+};
+
+template <typename S, typename F>
+S sequenceSum(const F& f, long n) {
+    long blocks = (n + blockLength - 1) / blockLength;
+    long chunks = blocks / chunkBlocks;
+    if (n < parallelThreshold || chunks < 2) {
+        return cpu::dispatch<CascadeKernel<S> >(f, n, 0L, blocks).result();
+    }
+    // Each whole chunk reduces to the single root of a subtree, the same
+    // value the serial cascade would build, so chunk roots are pushed into a
+    // cascade one level up. A group of chunks at a time keeps them on the stack.
+    const int group = 64;
+    Cascade<S> roots;
+    for (long c0 = 0; c0 < chunks; c0 += group) {
+        int tasks = (int)std::min<long>(group, chunks - c0);
+        S partial[group];
+        parallel::parallelFor(tasks, [&](int t) {
+            partial[t] = cpu::dispatch<CascadeKernel<S> >(f, n, (c0 + t) * chunkBlocks, (long)chunkBlocks).result();
+        });
+        for (int t = 0; t < tasks; t++) {
+            roots.push(partial[t]);
+        }
+    }
+    Cascade<S> tail = cpu::dispatch<CascadeKernel<S> >(f, n, chunks * chunkBlocks, blocks - chunks * chunkBlocks);
+    return tail.depth == 0 ? roots.result() : roots.result(tail.result());
+}
+
+// f(0) + ... + f(n - 1) of type T; f may be called from several threads
+template <typename T, typename F>
+T sum(long n, const F& f, Summation mode = Summation::Pairwise) {
+    if (mode == Summation::Compensated) {
+        return sequenceSum<Neumaier<T> >(f, n).value();
+    }
+    return sequenceSum<Plain<T> >(f, n).value();
+}
+
+// The same sum for elements that arrive one at a time (strided views):
+// they are buffered into blocks and reduced exactly as sum() would, so both
+// give the same bits for the same sequence.
+template <typename T>
+class Stream {
+    public:
+        explicit Stream(Summation mode = Summation::Pairwise) : mode_(mode) {}
+
+        void push(T x) {
+            buffer_[filled_++] = x;
+            if (filled_ == blockLength) {
+                flush();
+            }
+        }
+
+        T result() {
+            if (filled_ > 0) {
+                flush();
+            }
+            return mode_ == Summation::Compensated ? compensated_.result().value() : plain_.result().value();
+        }
+
+    private:
+        void flush() {
+            const T* b = buffer_;
+            auto f = [b](long i) { return b[i]; };
+            if (mode_ == Summation::Compensated) {
+                compensated_.push(cpu::dispatch<BlockKernel<Neumaier<T> > >(f, 0L, filled_));
+            }
+            else {
+                plain_.push(cpu::dispatch<BlockKernel<Plain<T> > >(f, 0L, filled_));
+            }
+            filled_ = 0;
+        }
+
+        Summation mode_;
+        T buffer_[blockLength];
+        int filled_ = 0;
+        Cascade<Plain<T> > plain_;
+        Cascade<Neumaier<T> > compensated_;
+};
+
+} // namespace reduce
+
+#endif
@@ -12,24 +12,26 @@ int main() {
 
     for(int i=0; i<1600; i++) {
         if(i % 2 == 0) {
-            x.set({i, 0},i);
-            y.set({i, 0} , 1);
+            x.set(i, 0, i);
+            y.set(i, 0, 1);
         } else {
-            x.set({i, 0} , i);
-            y.set({i, 0} , 0);
+            x.set(i, 0, i);
+            y.set(i, 0, 0);
         }
     }
 
     for (int i = 0; i < 400; i++)
     {
-        theta.set({i, 0}, i * 2);
-        theta2.set({i, 0}, 1);
+        theta.set(i, 0, i * 2);
+        theta2.set(i, 0, 1);
     }
     
 
     LogisticRegression<float> lr(x, y);
 
-    lr.fit(10000, 0.0001);
+    // Newton's method, until the gradient vanishes (at most 100 iterations)
+    lr.setSolver(Solver::Newton);
+    lr.fit(100);
     std::cout << std::endl;
 
     std::cout << lr.getWeights() << std::endl;
@@ -0,0 +1,4 @@
+#include <ndarray.h>
+
+template class NDArray<float>;
+template class NDArray<double>;
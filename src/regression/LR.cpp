@@ -1 +1,6 @@
-#include <LR.h>
\ No newline at end of file
+#include <LR.h>
+
+template class LinearRegression<float>;
+template class LinearRegression<double>;
+template class LogisticRegression<float>;
+template class LogisticRegression<double>;
@@ -0,0 +1,27 @@
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <cstdio>
+
+// Minimal checks for the test drivers: CHECK(cond) reports a failing
+// condition with its line and carries on; main returns check::failures(),
+// so ctest sees the test fail when any check did.
+namespace check {
+
+inline int& failures() {
+    static int count = 0;
+    return count;
+}
+
+inline void report(bool ok, const char* what, const char* file, int line) {
+    if (!ok) {
+        std::fprintf(stderr, "%s:%d: check failed: %s\n", file, line, what);
+        failures()++;
+    }
+}
+
+} // namespace check
+
+#define CHECK(cond) check::report((cond), #cond, __FILE__, __LINE__)
+
+#endif
@@ -0,0 +1,138 @@
+#include <cstdio>
+#include <ndarray.h>
+#include "check.h"
+
+// Copies share elements until one side is written, views write through to
+// the array they were taken from, assigning an array to a view rebinds the
+// view, and arrays mapped read-only from a file are copied on first write.
+
+// 3 x 4 with element (i, j) = 10 i + j
+NDArray<float> grid() {
+    NDArray<float> a({3, 4});
+    for (long i = 0; i < 3; i++) {
+        for (long j = 0; j < 4; j++) {
+            a.set(i, j, float(10 * i + j));
+        }
+    }
+    return a;
+}
+
+bool isGrid(const NDArray<float>& a) {
+    for (long i = 0; i < 3; i++) {
+        for (long j = 0; j < 4; j++) {
+            if (a.at(i, j) != float(10 * i + j)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void copiesAreIndependent() {
+    NDArray<float> a = grid();
+    NDArray<float> copied(a);
+    NDArray<float> assigned;
+    assigned = a;
+
+    copied.set(0, 0, -1.0f);
+    CHECK(copied.at(0, 0) == -1.0f);
+    CHECK(isGrid(a) && isGrid(assigned));
+
+    a += 1.0f;
+    CHECK(a.at(2, 3) == 24.0f);
+    CHECK(isGrid(assigned));
+    CHECK(copied.at(0, 0) == -1.0f && copied.at(2, 3) == 23.0f);
+
+    assigned.fill(0.0f);
+    CHECK(a.at(2, 3) == 24.0f);
+
+    // a view follows its array's writes, a copy taken alongside does not
+    NDArray<float> b = grid();
+    const NDArray<float>& cb = b;
+    NDArray<float> row = cb[1];
+    NDArray<float> before = b;
+    b.set(1, 2, 99.0f);
+    CHECK(row.at(2) == 99.0f);
+    CHECK(isGrid(before));
+
+    // copying a view gives an array of its own
+    NDArray<float> rowCopy = row;
+    rowCopy.set(0, -5.0f);
+    CHECK(b.at(1, 0) == 10.0f && row.at(0) == 10.0f);
+}
+
+void viewsWriteThrough() {
+    NDArray<float> a = grid();
+    const NDArray<float>& ca = a;
+    NDArray<float> z({4}, {1, 2, 3, 4});
+
+    NDArray<float> row = ca[1];
+    row += z;
+    CHECK(a.at(1, 0) == 11.0f && a.at(1, 3) == 17.0f);
+    row.set(0, 50.0f);
+    CHECK(a.at(1, 0) == 50.0f);
+
+    NDArray<float> t = a.transpose();
+    t.set(3, 2, -7.0f);
+    CHECK(a.at(2, 3) == -7.0f);
+
+    NDArray<float> column = a.slice(1, 2, 3);
+    column *= 0.0f;
+    CHECK(a.at(0, 2) == 0.0f && a.at(1, 2) == 0.0f && a.at(2, 2) == 0.0f);
+
+    // an expression is evaluated into the viewed elements
+    NDArray<float> last = ca[2];
+    last = expr::Leaf<float>(z);
+    CHECK(a.at(2, 0) == 1.0f && a.at(2, 3) == 4.0f);
+}
+
+// row = z makes row a copy of z (sharing z's elements) and leaves the
+// array row was taken from alone, unlike row += z
+void assignmentRebindsAView() {
+    NDArray<float> a = grid();
+    const NDArray<float>& ca = a;
+    NDArray<float> z({4}, {1, 2, 3, 4});
+
+    NDArray<float> row = ca[1];
+    row = z;
+    CHECK(row.at(0) == 1.0f && row.at(3) == 4.0f);
+    CHECK(isGrid(a));
+    // and row no longer writes into a, nor into z
+    row += 1.0f;
+    CHECK(isGrid(a));
+    CHECK(z.at(0) == 1.0f && row.at(0) == 2.0f);
+}
+
+// a read-only mapping is copied into memory by the first write; views of
+// the array follow it there, copies of it keep the file's values
+void readOnlyMapping() {
+    const std::string path = "copy_on_write_test.npy";
+    grid().save(path);
+    NDArray<float> mapped = NDArray<float>::load(path, npy::Mode::ReadOnly);
+    const NDArray<float>& cm = mapped;
+    NDArray<float> row = cm[0];
+    NDArray<float> copy = mapped;
+    CHECK(isGrid(mapped) && isGrid(copy));
+
+    mapped.set(0, 1, 42.0f);
+    CHECK(mapped.at(0, 1) == 42.0f);
+    CHECK(row.at(1) == 42.0f);
+    CHECK(isGrid(copy));
+    CHECK(isGrid(NDArray<float>::load(path, npy::Mode::Copy)));
+
+    // unshare() alone moves the array off the mapping too
+    NDArray<float> other = NDArray<float>::load(path, npy::Mode::ReadOnly);
+    other.unshare();
+    other += 1.0f;
+    CHECK(other.at(2, 3) == 24.0f);
+    CHECK(isGrid(NDArray<float>::load(path, npy::Mode::ReadOnly)));
+    std::remove(path.c_str());
+}
+
+int main() {
+    copiesAreIndependent();
+    viewsWriteThrough();
+    assignmentRebindsAView();
+    readOnlyMapping();
+    return check::failures();
+}
@@ -0,0 +1,32 @@
+#include <ndarray.h>
+#include "check.h"
+
+// An array of more than 2^31 elements: sizes, flat offsets and the
+// reductions over it must not wrap around in 32 bits. Takes about 2.2 GB.
+
+int main() {
+    const long n = (1L << 31) + 17;
+    NDArray<signed char> a({n});
+    CHECK(a.size() == n);
+    CHECK(a.shape()[0] == n);
+
+    a.set(5, -4);
+    a.set((1L << 31) + 3, 9);
+    a.set(n - 1, 7);
+    CHECK(a.at(n - 1) == 7);
+    CHECK(a.at((1L << 31) + 3) == 9);
+    CHECK(a.at(n - 2) == 0);
+
+    NDArray<signed char> mx = a.max(0, true);
+    CHECK(mx.size() == 1 && mx.at(0) == 9);
+    NDArray<signed char> mn = a.min(0, true);
+    CHECK(mn.size() == 1 && mn.at(0) == -4);
+
+    // a view past 2^31 sees the same elements
+    NDArray<signed char> tail = a.slice(0, n - 10, n);
+    CHECK(tail.size() == 10);
+    CHECK(tail.at(9) == 7);
+    NDArray<signed char> tmax = tail.max(0, true);
+    CHECK(tmax.at(0) == 7);
+    return check::failures();
+}
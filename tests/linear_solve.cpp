@@ -0,0 +1,147 @@
+#include <cmath>
+#include <random>
+#include <vector>
+#include <LR.h>
+#include "check.h"
+
+// The normal-equation path of LinearRegression: Cholesky on a well
+// conditioned system, the conditioning cutoff, and the pivoted QR fallback
+// with its zero coefficients for dependent columns. Targets are noiseless,
+// so every fit must recover the model exactly.
+
+bool near(double a, double b, double tol = 1e-9) {
+    return std::abs(a - b) <= tol * std::max(1.0, std::abs(b));
+}
+
+// n rows of d standard normal features
+ndarray<double> features(long n, long d, unsigned seed) {
+    std::mt19937 rng(seed);
+    std::normal_distribution<double> normal;
+    ndarray<double> x({n, d});
+    for (long i = 0; i < n; i++) {
+        for (long j = 0; j < d; j++) {
+            x.set(i, j, normal(rng));
+        }
+    }
+    return x;
+}
+
+// y = x w + b
+ndarray<double> targets(const ndarray<double>& x, const std::vector<double>& w, double b) {
+    long n = x.shape()[0];
+    ndarray<double> y({n, 1});
+    for (long i = 0; i < n; i++) {
+        double z = b;
+        for (long j = 0; j < (long)w.size(); j++) {
+            z += x.at(i, j) * w[j];
+        }
+        y.set(i, 0, z);
+    }
+    return y;
+}
+
+LinearRegression<double> solve(const ndarray<double>& x, const ndarray<double>& y) {
+    LinearRegression<double> model(x, y);
+    model.setSolver(Solver::NormalEquations);
+    model.fit();
+    return model;
+}
+
+// true when the normal matrix of [x 1] is accepted by solveSPD
+bool choleskyAccepts(const ndarray<double>& x, const ndarray<double>& y) {
+    int k = (int)x.shape()[1] + 1;
+    std::vector<double> gram = x.gramWithIntercept(y).toVector();
+    std::vector<double> a(k * k);
+    std::vector<double> rhs(k);
+    for (int i = 0; i < k; i++) {
+        std::copy(gram.begin() + i * (k + 1), gram.begin() + i * (k + 1) + k, a.begin() + i * k);
+        rhs[i] = gram[i * (k + 1) + k];
+    }
+    return linalg::solveSPD(k, a, rhs.data());
+}
+
+void solveSPDDirect() {
+    // [[4, 2], [2, 3]] x = [2, 1] has x = [0.5, 0]
+    std::vector<double> a = {4, 2, 2, 3};
+    std::vector<double> b = {2, 1};
+    CHECK(linalg::solveSPD(2, a, b.data()));
+    CHECK(near(b[0], 0.5) && near(b[1], 0.0));
+
+    // condition number about 2e6: kept
+    double e = 1e-6;
+    a = {1, 1 - e, 1 - e, 1};
+    b = {2 - e, 2 - e};
+    CHECK(linalg::solveSPD(2, a, b.data()));
+    CHECK(near(b[0], 1, 1e-6) && near(b[1], 1, 1e-6));
+
+    // condition number about 2e9, above 1 / sqrt(epsilon): positive
+    // definite, but refused so that the caller falls back to QR
+    e = 1e-9;
+    a = {1, 1 - e, 1 - e, 1};
+    b = {2 - e, 2 - e};
+    CHECK(!linalg::solveSPD(2, a, b.data()));
+
+    // not positive definite
+    a = {1, 2, 2, 1};
+    b = {1, 1};
+    CHECK(!linalg::solveSPD(2, a, b.data()));
+}
+
+void qrDirect() {
+    // column-major 4 x 3 with the third column equal to the first:
+    // rank 2, and the dependent column gets a zero coefficient
+    std::vector<double> a = {1, 2, 3, 4,
+                             1, 0, 1, 0,
+                             1, 2, 3, 4};
+    std::vector<double> b = {3, 4, 7, 8}; // 2 * col0 + 1 * col1
+    std::vector<double> x(3);
+    CHECK(linalg::qrLeastSquares(4, 3, a.data(), b.data(), x.data()) == 2);
+    CHECK(x[0] == 0.0 || x[2] == 0.0);
+    CHECK(near(x[0] + x[2], 2) && near(x[1], 1));
+}
+
+void fullRank() {
+    std::vector<double> w = {1.5, -2.0, 0.25, 3.0};
+    ndarray<double> x = features(500, 4, 1);
+    ndarray<double> y = targets(x, w, -0.75);
+    CHECK(choleskyAccepts(x, y));
+    LinearRegression<double> model = solve(x, y);
+    ndarray<double> fitted = model.getWeights();
+    for (int j = 0; j < 4; j++) {
+        CHECK(near(fitted.at(j, 0), w[j]));
+    }
+    CHECK(near(model.getBias().at(0, 0), -0.75));
+    CHECK(model.MSE() < 1e-20);
+}
+
+// x with columns (a, c, a) or (a, c, 2a): the normal matrix is singular,
+// so solve() takes the QR path; one of the dependent pair gets 0 and the
+// other the combined coefficient
+void dependentColumn(double factor) {
+    ndarray<double> base = features(300, 2, 2);
+    ndarray<double> x({300, 3});
+    for (long i = 0; i < 300; i++) {
+        x.set(i, 0, base.at(i, 0));
+        x.set(i, 1, base.at(i, 1));
+        x.set(i, 2, factor * base.at(i, 0));
+    }
+    // the model on (a, c): 2 a - c + 0.5
+    ndarray<double> y = targets(base, {2.0, -1.0}, 0.5);
+    CHECK(!choleskyAccepts(x, y));
+    LinearRegression<double> model = solve(x, y);
+    ndarray<double> w = model.getWeights();
+    CHECK(w.at(0, 0) == 0.0 || w.at(2, 0) == 0.0);
+    CHECK(near(w.at(0, 0) + factor * w.at(2, 0), 2.0));
+    CHECK(near(w.at(1, 0), -1.0));
+    CHECK(near(model.getBias().at(0, 0), 0.5));
+    CHECK(model.MSE() < 1e-20);
+}
+
+int main() {
+    solveSPDDirect();
+    qrDirect();
+    fullRank();
+    dependentColumn(1.0);
+    dependentColumn(2.0);
+    return check::failures();
+}
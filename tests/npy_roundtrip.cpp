@@ -0,0 +1,167 @@
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <ndarray.h>
+#include "check.h"
+
+// save() and load() in each npy::Mode: values, shapes and types survive,
+// writes to a mapped array never reach the file, and headers over 64 KiB
+// (format version 2) and column-major files are read.
+
+const npy::Mode modes[] = {npy::Mode::Copy, npy::Mode::ReadOnly, npy::Mode::CopyOnWrite};
+
+std::string contents(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    std::ostringstream bytes;
+    bytes << in.rdbuf();
+    return bytes.str();
+}
+
+void write(const std::string& path, const std::string& bytes) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(bytes.data(), bytes.size());
+}
+
+// 3 x 4 with element (i, j) = 10 i + j + offset
+template <typename T>
+NDArray<T> grid(T offset) {
+    NDArray<T> a({3, 4});
+    for (long i = 0; i < 3; i++) {
+        for (long j = 0; j < 4; j++) {
+            a.set(i, j, T(10 * i + j) + offset);
+        }
+    }
+    return a;
+}
+
+template <typename T>
+bool sameGrid(const NDArray<T>& a, T offset) {
+    if (a.shape() != dims::Dims({3, 4})) {
+        return false;
+    }
+    for (long i = 0; i < 3; i++) {
+        for (long j = 0; j < 4; j++) {
+            if (a.at(i, j) != T(10 * i + j) + offset) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+template <typename T>
+void roundTrip(T offset) {
+    const std::string path = "npy_roundtrip_grid.npy";
+    grid<T>(offset).save(path);
+    for (npy::Mode mode : modes) {
+        CHECK(sameGrid(NDArray<T>::load(path, mode), offset));
+    }
+    // a transposed view is saved in its own (logical) order
+    const std::string tpath = "npy_roundtrip_transposed.npy";
+    grid<T>(offset).transpose().save(tpath);
+    for (npy::Mode mode : modes) {
+        NDArray<T> t = NDArray<T>::load(tpath, mode);
+        CHECK(t.shape() == dims::Dims({4, 3}));
+        CHECK(t.at(3, 2) == T(23) + offset && t.at(1, 2) == T(21) + offset);
+    }
+    std::remove(path.c_str());
+    std::remove(tpath.c_str());
+}
+
+// writing to a loaded array changes the array, never the file
+void writesStayInMemory() {
+    const std::string path = "npy_roundtrip_writes.npy";
+    grid<double>(0.5).save(path);
+    std::string before = contents(path);
+    for (npy::Mode mode : modes) {
+        NDArray<double> a = NDArray<double>::load(path, mode);
+        NDArray<double> untouched = a;
+        a.set(0, 0, 99.0);
+        a += 1.0;
+        CHECK(a.at(0, 0) == 100.0 && a.at(2, 3) == 24.5);
+        CHECK(sameGrid(untouched, 0.5));
+        CHECK(contents(path) == before);
+        CHECK(sameGrid(NDArray<double>::load(path, npy::Mode::Copy), 0.5));
+    }
+    std::remove(path.c_str());
+}
+
+// a version 2 file: the same 3 x 4 doubles behind a header padded past the
+// 64 KiB that version 1 can describe
+void versionTwo() {
+    std::string dict = "{'descr': '" + npy::descr<double>() + "', 'fortran_order': False, 'shape': (3, 4), }";
+    std::size_t length = 70000;
+    length += (64 - (npy::magicLength + 6 + length) % 64) % 64;
+    dict.append(length - dict.size() - 1, ' ');
+    dict += '\n';
+    std::string bytes(npy::magic, npy::magicLength);
+    bytes += (char)2;
+    bytes += (char)0;
+    for (int i = 0; i < 4; i++) {
+        bytes += (char)((length >> (8 * i)) & 0xff);
+    }
+    bytes += dict;
+    std::vector<double> values = grid<double>(0.25).toVector();
+    bytes.append(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(double));
+
+    const std::string path = "npy_roundtrip_v2.npy";
+    write(path, bytes);
+    for (npy::Mode mode : modes) {
+        CHECK(sameGrid(NDArray<double>::load(path, mode), 0.25));
+    }
+    std::remove(path.c_str());
+
+    // and header() writes version 2 itself once the dict needs it
+    std::vector<long> shape(30000, 1);
+    std::string header = npy::header(npy::descr<float>(), shape);
+    CHECK(header[npy::magicLength] == 2);
+    CHECK(header.size() % npy::headerAlignment == 0);
+    npy::Header parsed = npy::parseHeader(header.data(), header.size());
+    CHECK(parsed.dataOffset == header.size());
+    CHECK(parsed.shape.size() == shape.size());
+    CHECK(parsed.descr == npy::descr<float>());
+}
+
+// fortran_order True: the bytes are the columns one after the other
+void columnMajor() {
+    std::string header = npy::header(npy::descr<float>(), {3, 4});
+    std::size_t at = header.find("False");
+    header.replace(at, 5, "True ");
+    std::vector<float> columns;
+    for (long j = 0; j < 4; j++) {
+        for (long i = 0; i < 3; i++) {
+            columns.push_back(float(10 * i + j));
+        }
+    }
+    const std::string path = "npy_roundtrip_fortran.npy";
+    write(path, header + std::string(reinterpret_cast<const char*>(columns.data()), columns.size() * sizeof(float)));
+    for (npy::Mode mode : modes) {
+        CHECK(sameGrid(NDArray<float>::load(path, mode), 0.0f));
+    }
+    std::remove(path.c_str());
+}
+
+int main() {
+    roundTrip<double>(0.5);
+    roundTrip<float>(0.25f);
+    roundTrip<int>(-7);
+    roundTrip<unsigned char>(3);
+    writesStayInMemory();
+    versionTwo();
+    columnMajor();
+
+    // the wrong element type is refused
+    grid<float>(0).save("npy_roundtrip_float.npy");
+    bool refused = false;
+    try {
+        NDArray<double>::load("npy_roundtrip_float.npy");
+    }
+    catch (const std::invalid_argument&) {
+        refused = true;
+    }
+    CHECK(refused);
+    std::remove("npy_roundtrip_float.npy");
+    return check::failures();
+}
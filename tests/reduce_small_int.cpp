@@ -0,0 +1,46 @@
+#include <ndarray.h>
+#include "check.h"
+
+// Axis reductions over integer types narrower than int, whose arithmetic
+// promotes to int: they must still compile and give the exact results.
+
+template <typename T>
+void checkType() {
+    // 2 x 3 with rows (1, -2, 3) and (4, 5, -6)
+    NDArray<T> a({2, 3}, {1, -2, 3, 4, 5, -6});
+
+    NDArray<T> s0 = a.sum(0);
+    CHECK(s0.size() == 3);
+    CHECK(s0.at(0) == 5 && s0.at(1) == 3 && s0.at(2) == -3);
+
+    NDArray<T> s1 = a.sum(1, true);
+    CHECK(s1.shape() == dims::Dims({2, 1}));
+    CHECK(s1.at(0, 0) == 2 && s1.at(1, 0) == 3);
+
+    NDArray<T> mx = a.max(0);
+    CHECK(mx.at(0) == 4 && mx.at(1) == 5 && mx.at(2) == 3);
+    NDArray<T> mn = a.min(0);
+    CHECK(mn.at(0) == 1 && mn.at(1) == -2 && mn.at(2) == -6);
+    NDArray<T> mn1 = a.min(1);
+    CHECK(mn1.at(0) == -2 && mn1.at(1) == -6);
+
+    // means truncate like integer division: (2, 1, -1); the centered pass
+    // then sums the squared deviations from them, (5, 25, 41) / 2
+    NDArray<T> m = a.mean(0);
+    CHECK(m.at(0) == 2 && m.at(1) == 1 && m.at(2) == -1);
+    NDArray<T> v = a.var(0);
+    CHECK(v.at(0) == 2 && v.at(1) == 12 && v.at(2) == 20);
+
+    // a transposed view takes the strided path
+    NDArray<T> t = a.transpose();
+    NDArray<T> st = t.sum(1);
+    CHECK(st.at(0) == 5 && st.at(1) == 3 && st.at(2) == -3);
+}
+
+int main() {
+    checkType<signed char>();
+    checkType<short>();
+    checkType<int>();
+    checkType<long>();
+    return check::failures();
+}
@@ -0,0 +1,134 @@
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <dataset.h>
+#include "check.h"
+
+// dataset::Stream over a CSV file of several chunks: every pass sees every
+// row once and in order, rewind() restarts cleanly wherever the reader is,
+// copies of a chunk outlive it, and a parse error in the background reader
+// is rethrown from next().
+
+const long rows = 1000;
+const int chunk = 64;
+
+// row i: features i, 2 i, -i, target i % 3; a blank line every 100 rows
+void writeCsv(const std::string& path, long badLine) {
+    std::ofstream out(path);
+    out << "a,b,c,y\n";
+    for (long i = 0; i < rows; i++) {
+        if (i % 100 == 50) {
+            out << "\n";
+        }
+        if (i == badLine) {
+            out << i << "," << 2 * i << "\n";
+            continue;
+        }
+        out << i << "," << 2 * i << "," << -i << "," << i % 3 << "\n";
+    }
+}
+
+struct Pass {
+    long rows = 0;
+    long chunks = 0;
+    double x = 0;
+    double y = 0;
+    bool ordered = true;
+};
+
+// read the rest of the current pass
+Pass readPass(dataset::Stream<double>& data) {
+    Pass pass;
+    NDArray<double> x;
+    NDArray<double> y;
+    while (data.next(x, y)) {
+        long n = x.shape()[0];
+        CHECK(n > 0 && n <= chunk);
+        CHECK(x.shape()[1] == 3 && y.shape()[0] == n);
+        for (long i = 0; i < n; i++) {
+            long row = pass.rows + i;
+            pass.ordered = pass.ordered && x.at(i, 0) == row && x.at(i, 1) == 2 * row && x.at(i, 2) == -row &&
+                           y.at(i, 0) == row % 3;
+        }
+        pass.rows += n;
+        pass.chunks++;
+        pass.x += x.sum();
+        pass.y += y.sum();
+    }
+    return pass;
+}
+
+void checkFull(const Pass& pass) {
+    CHECK(pass.rows == rows);
+    CHECK(pass.chunks == (rows + chunk - 1) / chunk);
+    CHECK(pass.ordered);
+    // sum of i + 2i - i over the rows, and of i % 3
+    CHECK(pass.x == 2.0 * rows * (rows - 1) / 2);
+    CHECK(pass.y == 999.0);
+}
+
+void passes(const std::string& path) {
+    dataset::Stream<double> data(std::make_shared<dataset::CsvSource<double> >(path, 1, true), chunk);
+    CHECK(data.features() == 3 && data.targets() == 1 && data.chunkRows() == chunk);
+    checkFull(readPass(data));
+    // after the end, next() keeps returning false until rewind()
+    NDArray<double> x;
+    NDArray<double> y;
+    CHECK(!data.next(x, y));
+    data.rewind();
+    checkFull(readPass(data));
+
+    // rewind after 0, 1, 2, ... chunks, with the reader usually busy on the
+    // chunk after, then a whole pass
+    for (int taken = 0; taken < 20; taken++) {
+        data.rewind();
+        for (int k = 0; k < taken && data.next(x, y); k++) {
+        }
+        data.rewind();
+        checkFull(readPass(data));
+    }
+
+    // a copy of a chunk keeps its rows after the stream moves on and
+    // refills that buffer
+    data.rewind();
+    CHECK(data.next(x, y));
+    NDArray<double> kept = x;
+    for (int k = 0; k < 3; k++) {
+        CHECK(data.next(x, y));
+    }
+    CHECK(kept.shape()[0] == chunk && kept.at(0, 0) == 0 && kept.at(chunk - 1, 1) == 2 * (chunk - 1));
+}
+
+void malformed(const std::string& path) {
+    // data row 150 has two columns: the third chunk (rows 128 to 191) fails
+    writeCsv(path, 150);
+    dataset::Stream<double> data(std::make_shared<dataset::CsvSource<double> >(path, 1, true), chunk);
+    for (int pass = 0; pass < 2; pass++) {
+        NDArray<double> x;
+        NDArray<double> y;
+        CHECK(data.next(x, y) && x.at(0, 0) == 0);
+        CHECK(data.next(x, y) && x.at(0, 0) == chunk);
+        bool thrown = false;
+        try {
+            data.next(x, y);
+        }
+        catch (const std::invalid_argument& e) {
+            thrown = std::string(e.what()).find("fewer than 4 columns") != std::string::npos;
+        }
+        CHECK(thrown);
+        // the pass is over; a rewind gives the same rows and error again
+        CHECK(!data.next(x, y));
+        data.rewind();
+    }
+}
+
+int main() {
+    const std::string path = "stream_test.csv";
+    writeCsv(path, -1);
+    passes(path);
+    malformed(path);
+    std::remove(path.c_str());
+    return check::failures();
+}
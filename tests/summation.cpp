@@ -0,0 +1,141 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <vector>
+#include <ndarray.h>
+#include <parallel.h>
+#include "check.h"
+
+// sum() and dot() against a long double reference on badly conditioned
+// input, and bit for bit the same result whatever the thread count.
+
+// n values: pairs +v and -v with v around 1e8, every other value 1, in
+// shuffled order. The exact sum is the number of ones, n / 2, while the
+// magnitudes add up to about 1e8 n / 2, so the sum is conditioned ~1e8.
+template <typename T>
+std::vector<T> cancelling(long n, unsigned seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> size(0.5e8, 1.5e8);
+    std::vector<T> values;
+    values.reserve(n);
+    for (long i = 0; i + 4 <= n; i += 4) {
+        T v = T(size(rng));
+        values.push_back(v);
+        values.push_back(T(1));
+        values.push_back(-v);
+        values.push_back(T(1));
+    }
+    while ((long)values.size() < n) {
+        values.push_back(T(0));
+    }
+    std::shuffle(values.begin(), values.end(), rng);
+    return values;
+}
+
+template <typename T>
+long double exactSum(const std::vector<T>& a, const std::vector<T>& b) {
+    long double s = 0;
+    for (size_t i = 0; i < a.size(); i++) {
+        s += (long double)a[i] * (long double)b[i];
+    }
+    return s;
+}
+
+template <typename T>
+void accuracy(long n) {
+    std::vector<T> values = cancelling<T>(n, 1);
+    // powers of two, so the products are exact and the dot product's
+    // reference is exact too
+    std::vector<T> weights(n);
+    std::mt19937 rng(2);
+    for (long i = 0; i < n; i++) {
+        weights[i] = T(rng() % 2 == 0 ? 1 : 2);
+    }
+    std::vector<T> ones(n, T(1));
+    long double sumRef = exactSum(values, ones);
+    long double dotRef = exactSum(values, weights);
+    long double sumMagnitude = 0;
+    long double dotMagnitude = 0;
+    for (long i = 0; i < n; i++) {
+        sumMagnitude += std::abs((long double)values[i]);
+        dotMagnitude += std::abs((long double)values[i] * weights[i]);
+    }
+
+    NDArray<T> a({n}, values);
+    NDArray<T> b({n}, weights);
+    T eps = std::numeric_limits<T>::epsilon();
+    // pairwise: within log2(n) roundings of the magnitudes; compensated: a
+    // few roundings of the result itself, plus a second-order term in the
+    // magnitudes
+    long double log2n = std::log2((double)n);
+    long double sumPairwiseBound = log2n * eps * sumMagnitude;
+    long double dotPairwiseBound = log2n * eps * dotMagnitude;
+    long double sumCompensatedBound = 4 * eps * std::abs(sumRef) + n * eps * eps * sumMagnitude;
+    long double dotCompensatedBound = 4 * eps * std::abs(dotRef) + n * eps * eps * dotMagnitude;
+
+    T s = a.sum();
+    T sc = a.sum(reduce::Summation::Compensated);
+    T d = a.dot(b);
+    T dc = a.dot(b, reduce::Summation::Compensated);
+    CHECK(std::abs(s - sumRef) <= sumPairwiseBound);
+    CHECK(std::abs(d - dotRef) <= dotPairwiseBound);
+    CHECK(std::abs(sc - sumRef) <= sumCompensatedBound);
+    CHECK(std::abs(dc - dotRef) <= dotCompensatedBound);
+    CHECK(std::abs(sc - sumRef) <= std::abs(s - sumRef));
+    CHECK(std::abs(dc - dotRef) <= std::abs(d - dotRef));
+}
+
+template <typename T>
+bool sameBits(T a, T b) {
+    return std::memcmp(&a, &b, sizeof(T)) == 0;
+}
+
+// every result at one thread, then at several
+template <typename T>
+void threadCounts(long n) {
+    std::mt19937 rng(3);
+    std::uniform_real_distribution<double> u(-1, 1);
+    std::vector<T> values(n);
+    std::vector<T> weights(n);
+    for (long i = 0; i < n; i++) {
+        values[i] = T(u(rng));
+        weights[i] = T(u(rng));
+    }
+    NDArray<T> a({n}, values);
+    NDArray<T> b({n}, weights);
+    NDArray<T> m({n / 1000, 1000}, std::vector<T>(values.begin(), values.begin() + n / 1000 * 1000));
+
+    T results[2][5];
+    NDArray<T> axis[2][2];
+    const int threads[2] = {1, 8};
+    for (int k = 0; k < 2; k++) {
+        parallel::setNumThreads(threads[k]);
+        results[k][0] = a.sum();
+        results[k][1] = a.sum(reduce::Summation::Compensated);
+        results[k][2] = a.dot(b);
+        results[k][3] = a.dot(b, reduce::Summation::Compensated);
+        results[k][4] = (a * b + a).sum();
+        axis[k][0] = m.sum(0);
+        axis[k][1] = m.sum(1);
+    }
+    parallel::setNumThreads(parallel::defaultNumThreads());
+    for (int i = 0; i < 5; i++) {
+        CHECK(sameBits(results[0][i], results[1][i]));
+    }
+    for (int j = 0; j < 2; j++) {
+        std::vector<T> one = axis[0][j].toVector();
+        std::vector<T> several = axis[1][j].toVector();
+        CHECK(one.size() == several.size());
+        CHECK(std::memcmp(one.data(), several.data(), one.size() * sizeof(T)) == 0);
+    }
+}
+
+int main() {
+    accuracy<float>(1 << 20);
+    accuracy<double>((1 << 20) + 12345);
+    // above the parallel threshold, with a length that is not a power of two
+    threadCounts<float>((1L << 21) + 12345);
+    threadCounts<double>((1L << 21) + 12345);
+    return check::failures();
+}